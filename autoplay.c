@@ -0,0 +1,304 @@
+#include "autoplay.h"
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// 评分的权重，正的越多越好，负的越少越好
+#define WEIGHT_HEIGHT           (-0.510066)     // 各列高度之和
+#define WEIGHT_LINES            0.760666        // 消去的行数，各层之和
+#define WEIGHT_HOLES            (-0.35663)      // 空洞，即上方有方块的空格数
+#define WEIGHT_BUMPINESS        (-0.184483)     // 相邻两列高度差的绝对值之和
+
+// 游戏结束的分数，比任何正常的局面都低
+#define GAME_OVER_SCORE         (-DBL_MAX)
+
+// 每次选择落点最多的工作量：搜索的每个结点都要复制整个游戏并评分，都与game_info_size成正比，
+// 所以以结点数乘以其大小估计，超出时减少考虑的预报骨板个数，使每次选择都远在一次自动下落的时间之内完成
+#define SEARCH_BUDGET           ((uint64_t) 1 << 26)
+
+
+// 一个可以到达的落点，moved是从初始位置旋转、平移之后还未下落时的骨板，landed是落到底后的
+typedef struct {
+    Tetrimino moved;
+    Tetrimino landed;
+} Placement;
+
+struct Autoplayer {
+    // 要求考虑的预报骨板个数，以及按当前游戏池大小实际考虑的个数
+    int lookahead;
+    int depth;
+    ThreadPool *pool;
+    int worker_count;
+    StepFunction step;
+
+    // 每个工作线程lookahead + 1个游戏副本，依次用于每一层，game_size是其大小
+    // 以及同样多的落点数组，用于列举每一层之后的骨板的落点
+    GameInfo **scratch;
+    size_t game_size;
+    Placement **lists;
+
+    // 本次搜索中第一个骨板的各个落点及其得分
+    Placement *placements;
+    double *scores;
+    int placement_count;
+    int placement_capacity;
+    GameInfo *game;
+
+    // 选定的落点，以及最多还会给出的移动动作数，防止意外移动不到时一直尝试
+    Tetrimino target;
+    int moves_left;
+};
+
+
+// 单个骨板的全部落点最多有多少个：每个朝向每一列一个
+static int max_placements(GameInfo *game) {
+    return 4 * (game->width + 2 * MAX_TETRIMINO_LENGTH);
+}
+
+
+// 按工作量的上限，这一大小的游戏池最多能考虑几个预报骨板，不超过lookahead，连当前骨板也搜索不了时返回-1
+// 每一层的落点数按每个朝向每一列一个估计，通常比max_placements少得多
+static int search_depth(Coordinate width, Coordinate height, int lookahead) {
+    uint64_t placements = 4 * (uint64_t) width;
+    uint64_t cost = placements * game_info_size(width, height);
+    int depth = -1;
+    while (depth < lookahead && cost <= SEARCH_BUDGET) {
+        depth++;
+        cost *= placements;
+    }
+    return depth;
+}
+
+
+bool autoplay_supported(Coordinate width, Coordinate height) {
+    return search_depth(width, height, 0) >= 0;
+}
+
+
+// 加入一个落点，与已有的落点占据同样的格子时忽略，例如O骨板的各个朝向
+static void add_placement(GameInfo *game, Placement *placements, int *count, const Tetrimino *moved) {
+    Tetrimino landed = *moved;
+    landed.y -= drop_distance(game, &landed);
+    const TetriminoShape *shape = tetrimino_shape(&landed);
+    for (int i = 0; i < *count; i++) {
+        const Tetrimino *other = &placements[i].landed;
+        if (other->x == landed.x && other->y == landed.y &&
+            memcmp(tetrimino_shape(other)->rows, shape->rows, sizeof(shape->rows)) == 0) {
+            return;
+        }
+    }
+    placements[*count].moved = *moved;
+    placements[*count].landed = landed;
+    (*count)++;
+}
+
+// 列举当前骨板的全部落点：依次旋转0到3次，每个朝向分别向左、向右平移到底，途经的每个位置直接下落
+// 与next_autoplay_action的移动顺序一致，所以列举出来的落点一定能够到达
+static int list_placements(GameInfo *game, Placement *placements) {
+    int count = 0;
+    Tetrimino rotated = game->current;
+    for (int r = 0; r < 4; r++) {
+        if (r > 0 && !rotate_tetrimino(game, &rotated)) {
+            break;
+        }
+        add_placement(game, placements, &count, &rotated);
+        for (Coordinate direction = -1; direction <= 1; direction += 2) {
+            Tetrimino moved = rotated;
+            while (shift_tetrimino(game, &moved, direction, 0)) {
+                add_placement(game, placements, &count, &moved);
+            }
+        }
+    }
+    return count;
+}
+
+
+// 局面的评分，不含消行数
+static double evaluate_board(GameInfo *game) {
+    double height = 0, holes = 0, bumpiness = 0;
+    for (Coordinate x = 0; x < game->width; x++) {
+        Coordinate column = *column_height(game, x);
+        height += column;
+        if (x > 0) {
+            Coordinate left = *column_height(game, x - 1);
+            bumpiness += column > left ? column - left : left - column;
+        }
+        for (Coordinate y = 0; y < column; y++) {
+            holes += !well_occupied(game, x, y);
+        }
+    }
+    return WEIGHT_HEIGHT * height + WEIGHT_HOLES * holes + WEIGHT_BUMPINESS * bumpiness;
+}
+
+
+// 在scratch[depth - 1]（depth为0时是game）的基础上把骨板放到placement，然后继续搜索之后的骨板，返回最好的得分
+// lists与scratch一样是本线程的，lists[depth]用于列举这一层之后的骨板的落点
+static double search(Autoplayer *autoplayer, GameInfo **scratch, Placement **lists, GameInfo *game,
+                     const Placement *placement, int depth, int lines) {
+    GameInfo *next = scratch[depth];
+    memcpy(next, game, autoplayer->game_size);
+    next->current = placement->landed;
+    StepEvents events = autoplayer->step(next, ACTION_DOWN);
+    if (events.flags & EVENT_GAME_OVER) {
+        return GAME_OVER_SCORE;
+    }
+    lines += events.full_count;
+    if (depth == autoplayer->depth) {
+        return WEIGHT_LINES * lines + evaluate_board(next);
+    }
+
+    Placement *placements = lists[depth];
+    int count = list_placements(next, placements);
+    double best = GAME_OVER_SCORE;
+    for (int i = 0; i < count; i++) {
+        double score = search(autoplayer, scratch, lists, next, &placements[i], depth + 1, lines);
+        if (score > best) {
+            best = score;
+        }
+    }
+    return best;
+}
+
+static void search_task(void *context, size_t index, int worker) {
+    Autoplayer *autoplayer = context;
+    size_t offset = (size_t) worker * (autoplayer->lookahead + 1);
+    autoplayer->scores[index] = search(autoplayer, &autoplayer->scratch[offset], &autoplayer->lists[offset],
+                                       autoplayer->game, &autoplayer->placements[index], 0, 0);
+}
+
+
+Autoplayer *create_autoplayer(int lookahead, ThreadPool *pool) {
+    Autoplayer *autoplayer = calloc(1, sizeof(Autoplayer));
+    if (!autoplayer) {
+        return NULL;
+    }
+    autoplayer->lookahead = lookahead < 0 ? 0 : lookahead > MAX_LOOKAHEAD ? MAX_LOOKAHEAD : lookahead;
+    autoplayer->pool = pool;
+    autoplayer->step = step_game;
+    autoplayer->worker_count = pool ? thread_pool_size(pool) : 1;
+    size_t scratch_count = (size_t) autoplayer->worker_count * (autoplayer->lookahead + 1);
+    autoplayer->scratch = calloc(scratch_count, sizeof(GameInfo *));
+    autoplayer->lists = calloc(scratch_count, sizeof(Placement *));
+    if (!autoplayer->scratch || !autoplayer->lists) {
+        free(autoplayer->scratch);
+        free(autoplayer->lists);
+        free(autoplayer);
+        return NULL;
+    }
+    return autoplayer;
+}
+
+
+void destroy_autoplayer(Autoplayer *autoplayer) {
+    for (int i = 0; i < autoplayer->worker_count * (autoplayer->lookahead + 1); i++) {
+        free(autoplayer->scratch[i]);
+        free(autoplayer->lists[i]);
+    }
+    free(autoplayer->scratch);
+    free(autoplayer->lists);
+    free(autoplayer->placements);
+    free(autoplayer->scores);
+    free(autoplayer);
+}
+
+
+void set_autoplay_step_function(Autoplayer *autoplayer, StepFunction step) {
+    autoplayer->step = step;
+}
+
+
+// 按游戏池的大小准备各个缓冲，失败返回false
+static bool prepare_buffers(Autoplayer *autoplayer, GameInfo *game) {
+    if ((autoplayer->depth = search_depth(game->width, game->height, autoplayer->lookahead)) < 0) {
+        return false;
+    }
+    size_t game_size = game_info_size(game->width, game->height);
+    int scratch_count = autoplayer->worker_count * (autoplayer->lookahead + 1);
+    if (game_size != autoplayer->game_size) {
+        for (int i = 0; i < scratch_count; i++) {
+            free(autoplayer->scratch[i]);
+            if (!(autoplayer->scratch[i] = malloc(game_size))) {
+                autoplayer->game_size = 0;
+                return false;
+            }
+        }
+        autoplayer->game_size = game_size;
+    }
+    int capacity = max_placements(game);
+    if (capacity > autoplayer->placement_capacity) {
+        Placement *placements = realloc(autoplayer->placements, sizeof(Placement) * capacity);
+        if (placements) {
+            autoplayer->placements = placements;
+        }
+        double *scores = realloc(autoplayer->scores, sizeof(double) * capacity);
+        if (scores) {
+            autoplayer->scores = scores;
+        }
+        if (!placements || !scores) {
+            return false;
+        }
+        for (int i = 0; i < scratch_count; i++) {
+            Placement *list = realloc(autoplayer->lists[i], sizeof(Placement) * capacity);
+            if (!list) {
+                return false;
+            }
+            autoplayer->lists[i] = list;
+        }
+        autoplayer->placement_capacity = capacity;
+    }
+    return true;
+}
+
+
+void plan_placement(Autoplayer *autoplayer, GameInfo *game) {
+    // 搜索不了时（内存不足或者游戏池太大）原地快速下降
+    autoplayer->target = game->current;
+    autoplayer->moves_left = 0;
+    if (!prepare_buffers(autoplayer, game)) {
+        return;
+    }
+
+    autoplayer->game = game;
+    autoplayer->placement_count = list_placements(game, autoplayer->placements);
+    if (autoplayer->pool) {
+        run_thread_pool(autoplayer->pool, autoplayer->placement_count, search_task, autoplayer);
+    } else {
+        for (int i = 0; i < autoplayer->placement_count; i++) {
+            search_task(autoplayer, i, 0);
+        }
+    }
+
+    // 得分相同时取列举顺序中靠前的，结果是确定的
+    int best = -1;
+    for (int i = 0; i < autoplayer->placement_count; i++) {
+        if (best < 0 || autoplayer->scores[i] > autoplayer->scores[best]) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        Tetrimino *target = &autoplayer->placements[best].moved;
+        autoplayer->target = *target;
+        autoplayer->moves_left = 4 + game->width;
+    }
+}
+
+
+Action next_autoplay_action(Autoplayer *autoplayer, GameInfo *game) {
+    Tetrimino *current = &game->current;
+    Tetrimino *target = &autoplayer->target;
+    if (autoplayer->moves_left > 0) {
+        autoplayer->moves_left--;
+        if (current->rotation != target->rotation) {
+            return ACTION_ROTATE;
+        } else if (current->x < target->x) {
+            return ACTION_RIGHT;
+        } else if (current->x > target->x) {
+            return ACTION_LEFT;
+        }
+        autoplayer->moves_left = 0;
+    }
+    // 快速下降只落到底，再下落一次才坠地
+    return drop_distance(game, current) > 0 ? ACTION_FAST_DOWN : ACTION_DOWN;
+}
@@ -0,0 +1,37 @@
+#ifndef AUTOPLAY_H
+#define AUTOPLAY_H
+
+// 自动游戏：每个新骨板产生时，列举当前骨板所有可以到达的落点，以及之后预报中的骨板的落点，
+// 按照坠地后游戏池的高度、空洞、起伏和消行数打分，选出最好的，然后逐个给出移动过去的动作
+// 搜索在线程池中进行，第一个骨板的每个落点是一个任务，结果与线程数无关
+
+#include "tetris.h"
+#include "thread_pool.h"
+
+
+typedef struct Autoplayer Autoplayer;
+
+// 最多考虑的预报骨板个数，更后面的骨板还没有产生
+#define MAX_LOOKAHEAD           FORECAST_COUNT
+
+
+// 每次选择落点的搜索量随游戏池的宽度和大小增长，有一个上限，超出时自动减少考虑的预报骨板个数
+// 这一大小的游戏池连当前骨板的落点也搜索不了时返回false，此时不能自动游戏
+bool autoplay_supported(Coordinate width, Coordinate height);
+
+// 创建自动游戏，lookahead为除了当前骨板以外最多考虑的预报骨板个数，不超过MAX_LOOKAHEAD
+// pool为NULL时在调用者的线程中搜索，失败返回NULL
+Autoplayer *create_autoplayer(int lookahead, ThreadPool *pool);
+
+void destroy_autoplayer(Autoplayer *autoplayer);
+
+// 搜索中让骨板坠地所用的规则实现，默认为step_game，例如可以换成board.h中按大小特化的版本
+void set_autoplay_step_function(Autoplayer *autoplayer, StepFunction step);
+
+// 为当前骨板选定落点，每个新骨板产生后调用一次
+void plan_placement(Autoplayer *autoplayer, GameInfo *game);
+
+// 将当前骨板移向选定落点的下一个动作，先旋转，再平移，最后快速下降并坠地
+Action next_autoplay_action(Autoplayer *autoplayer, GameInfo *game);
+
+#endif
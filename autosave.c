@@ -0,0 +1,199 @@
+#include "autosave.h"
+#include "save.h"
+#include "threads.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// 进度的快照，与GameInfo的布局相同，由后台线程序列化
+// 各列最高的方块以上都是空的，只复制其下的rows行；dirty行以下可能还留着以前的快照的内容，后台线程序列化之前清空
+typedef struct {
+    GameInfo *game;
+    Coordinate rows;
+    Coordinate dirty;
+} Snapshot;
+
+
+static const char *save_path;
+static bool running;
+static Thread thread;
+
+// 以下由mutex保护，condition在提交快照、写完快照以及要求结束时都会广播
+static Mutex mutex;
+static Condition condition;
+static Snapshot pending;
+static bool has_pending;
+static bool stopping;
+// 每个快照提交时编一个递增的序号，written是最后写完的那个
+static uint64_t submitted;
+static uint64_t written;
+static bool written_successfully;
+
+// 只由游戏线程使用，生成快照后与pending交换，这样临界区内只交换指针
+static Snapshot spare;
+
+
+// 游戏线程中只复制有方块的各行，与游戏池的大小无关；很大的游戏池逐格序列化要慢得多，留给后台线程
+static bool take_snapshot(Snapshot *snapshot, GameInfo *game) {
+    if (!snapshot->game || snapshot->game->width != game->width || snapshot->game->height != game->height) {
+        free(snapshot->game);
+        // calloc分配，没有用到的上部不占实际内存
+        if (!(snapshot->game = create_empty_game(game->width, game->height))) {
+            return false;
+        }
+        snapshot->dirty = 0;
+    }
+    GameInfo *copy = snapshot->game;
+    Coordinate rows = 0;
+    for (Coordinate x = 0; x < game->width; x++) {
+        rows = *column_height(game, x) > rows ? *column_height(game, x) : rows;
+    }
+    memcpy(copy, game, offsetof(GameInfo, well));
+    memcpy(well_block(copy, 0, 0), well_block(game, 0, 0), sizeof(BlockType) * game->width * rows);
+    memcpy(well_row(copy, 0), well_row(game, 0), sizeof(RowBits) * game->row_words * rows);
+    memcpy(column_height(copy, 0), column_height(game, 0), sizeof(Coordinate) * game->width);
+    snapshot->rows = rows;
+    snapshot->dirty = rows > snapshot->dirty ? rows : snapshot->dirty;
+    return true;
+}
+
+// 在后台线程中清空rows以上残留的旧内容，之后快照就是完整的进度
+static void clear_stale_rows(Snapshot *snapshot) {
+    GameInfo *copy = snapshot->game;
+    if (snapshot->dirty > snapshot->rows) {
+        Coordinate count = snapshot->dirty - snapshot->rows;
+        memset(well_block(copy, 0, snapshot->rows), BLOCK_TYPE_NULL, sizeof(BlockType) * copy->width * count);
+        memset(well_row(copy, snapshot->rows), 0, sizeof(RowBits) * copy->row_words * count);
+        snapshot->dirty = snapshot->rows;
+    }
+}
+
+
+// 提交快照，返回其序号，失败返回0
+static uint64_t submit_snapshot(GameInfo *game) {
+    if (!take_snapshot(&spare, game)) {
+        return 0;
+    }
+    mutex_lock(&mutex);
+    Snapshot tmp = pending;
+    pending = spare;
+    spare = tmp;
+    has_pending = true;
+    uint64_t sequence = ++submitted;
+    condition_broadcast(&condition);
+    mutex_unlock(&mutex);
+    return sequence;
+}
+
+
+static THREAD_FUNCTION(autosave_main, argument) {
+    name_trace_thread("autosave");
+    Snapshot writing = {NULL, 0, 0};
+    // 序列化的结果，只由后台线程使用
+    uint8_t *data = NULL;
+    size_t capacity = 0;
+    mutex_lock(&mutex);
+    while (true) {
+        while (!has_pending && !stopping) {
+            condition_wait(&condition, &mutex);
+        }
+        // 要求结束时也要先把最后的快照写完
+        if (!has_pending) {
+            break;
+        }
+        Snapshot tmp = writing;
+        writing = pending;
+        pending = tmp;
+        has_pending = false;
+        uint64_t sequence = submitted;
+        mutex_unlock(&mutex);
+
+        bool successful = false;
+        clear_stale_rows(&writing);
+        size_t size = saved_game_size(writing.game);
+        if (size > capacity) {
+            uint8_t *buffer = realloc(data, size);
+            if (buffer) {
+                data = buffer;
+                capacity = size;
+            }
+        }
+        if (size <= capacity) {
+            TRACE_SPAN("serialize_game") {
+                size = serialize_game(writing.game, data);
+            }
+            TRACE_SPAN("write_file_atomically") {
+                successful = write_file_atomically(save_path, data, size);
+            }
+        }
+
+        mutex_lock(&mutex);
+        written = sequence;
+        written_successfully = successful;
+        condition_broadcast(&condition);
+    }
+    mutex_unlock(&mutex);
+    free(writing.game);
+    free(data);
+    (void) argument;
+    THREAD_RETURN;
+}
+
+
+bool start_autosave(const char *path) {
+    save_path = path;
+    mutex_init(&mutex);
+    condition_init(&condition);
+    running = thread_create(&thread, autosave_main, NULL);
+    if (!running) {
+        condition_destroy(&condition);
+        mutex_destroy(&mutex);
+    }
+    return running;
+}
+
+
+void autosave_game(GameInfo *game) {
+    if (running) {
+        submit_snapshot(game);
+    } else {
+        save_game_file(save_path, game);
+    }
+}
+
+
+bool save_game_now(GameInfo *game) {
+    if (!running) {
+        return save_game_file(save_path, game);
+    }
+    uint64_t sequence = submit_snapshot(game);
+    if (!sequence) {
+        return false;
+    }
+    mutex_lock(&mutex);
+    while (written < sequence) {
+        condition_wait(&condition, &mutex);
+    }
+    bool successful = written_successfully;
+    mutex_unlock(&mutex);
+    return successful;
+}
+
+
+void stop_autosave(void) {
+    if (!running) {
+        return;
+    }
+    mutex_lock(&mutex);
+    stopping = true;
+    condition_broadcast(&condition);
+    mutex_unlock(&mutex);
+    thread_join(thread);
+    condition_destroy(&condition);
+    mutex_destroy(&mutex);
+    free(pending.game);
+    free(spare.game);
+    running = false;
+}
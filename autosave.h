@@ -0,0 +1,22 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+// 后台保存进度：游戏线程只复制GameInfo中有方块的各行以及各列高度作为快照，与游戏池的大小无关，
+// 由后台线程序列化后写入文件并落盘，游戏不会因为很大的游戏池、缓慢的磁盘或者网络文件系统而卡顿
+
+#include "tetris.h"
+
+
+// 启动后台保存线程，之后的快照都写入path，失败返回false，此时保存都在调用者线程中进行
+bool start_autosave(const char *path);
+
+// 提交一个快照后立即返回，后台线程空闲时写入；还没来得及写入的旧快照直接被新的替换
+void autosave_game(GameInfo *game);
+
+// 提交一个快照并等待它写入完成，返回是否成功，用于玩家主动保存
+bool save_game_now(GameInfo *game);
+
+// 写完尚未写入的快照，然后结束后台线程
+void stop_autosave(void);
+
+#endif
@@ -0,0 +1,431 @@
+#include "platform.h"
+#include "tetris.h"
+#include "board.h"
+#include "rowscan.h"
+#include "display.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+// 热点路径的微基准：每项先试运行确定迭代次数，使一次运行约MIN_TIME，再重复REPETITIONS次取中位数
+// 游戏池、骨板和输入都由固定的种子产生，每次运行的工作完全相同，可以在不同版本间比较
+// 绘制的输出重定向到/dev/null，只衡量生成输出的开销，输出字节数由get_output_stats统计
+
+
+#define MIN_TIME                200000000   // 纳秒
+#define REPETITIONS             5
+#define SEED                    2024
+
+// 拥挤的游戏池中预先生成的骨板位置数，各项基准依次循环使用
+#define POSITION_COUNT          1024
+// 拥挤的游戏池中有方块的行数
+#define CROWDED_ROWS            14
+// 宽游戏池的大小，用于行扫描和压缩的基准
+#define WIDE_WIDTH              4096
+#define WIDE_HEIGHT             32
+
+
+// 防止被测代码的结果被优化掉
+static volatile uint64_t sink;
+
+typedef struct {
+    const char *name;
+    // 执行iterations次操作
+    void (*run)(uint64_t iterations);
+    // 是否绘制，绘制的基准另外输出每次操作的字节数
+    bool draws;
+    // 行扫描使用的内核，NULL为自动选择，当前处理器不支持时跳过
+    const char *kernel;
+} Benchmark;
+
+
+static GameInfo *crowded_game;
+static Tetrimino positions[POSITION_COUNT];
+
+// 消行的基准：游戏池的模板，以及每次从模板复制过来的游戏池
+static GameInfo *lock_template;
+static GameInfo *clear_template;
+static GameInfo *scratch_game;
+static size_t template_size;
+// 宽游戏池中消行的模板，布局与clear_template相同，wide_locked是其中的I骨板已经置入后的样子
+static GameInfo *wide_template;
+static GameInfo *wide_locked;
+static GameInfo *wide_scratch;
+static size_t wide_size;
+// 默认大小的游戏池的编译期特化版本的规则
+static StepFunction specialized_step;
+
+
+// 在游戏池的[bottom, top)这几行随机填上方块，每行至少有一个空格，所以没有满行
+static void fill_rows(GameInfo *game, Coordinate bottom, Coordinate top, Random *random) {
+    for (Coordinate y = bottom; y < top; y++) {
+        Coordinate hole = (Coordinate) random_below(random, (uint32_t) game->width);
+        for (Coordinate x = 0; x < game->width; x++) {
+            if (x != hole && random_below(random, 4) != 0) {
+                set_well_block(game, x, y,
+                               (BlockType) (BLOCK_TYPE_NORMAL_MIN + random_below(random, TETRIMINO_SHAPE_COUNT)));
+            }
+        }
+    }
+    update_column_heights(game);
+}
+
+// 除了第hole列以外都填满的一行
+static void fill_row_except(GameInfo *game, Coordinate y, Coordinate hole) {
+    for (Coordinate x = 0; x < game->width; x++) {
+        if (x != hole) {
+            set_well_block(game, x, y, BLOCK_TYPE_NORMAL_MIN + 1);
+        }
+    }
+}
+
+static void prepare_games(void) {
+    Random random;
+    random_seed(&random, SEED);
+    specialized_step = select_step_function(DEFAULT_WELL_WIDTH, DEFAULT_WELL_HEIGHT);
+    crowded_game = create_new_game(DEFAULT_WELL_WIDTH, DEFAULT_WELL_HEIGHT, SEED, RANDOMIZER_BAG);
+    if (!crowded_game) {
+        return;
+    }
+    fill_rows(crowded_game, 0, CROWDED_ROWS, &random);
+    // 骨板散布在方块之间以及其上方，其中一部分本身就与方块重叠，平移和旋转的结果各种情况都有
+    for (int i = 0; i < POSITION_COUNT; i++) {
+        positions[i].type = (BlockType) (BLOCK_TYPE_NORMAL_MIN + random_below(&random, TETRIMINO_SHAPE_COUNT));
+        positions[i].rotation = (uint8_t) random_below(&random, 4);
+        positions[i].x = (Coordinate) random_below(&random, (uint32_t) crowded_game->width - 1);
+        positions[i].y = (Coordinate) random_below(&random, CROWDED_ROWS + MAX_TETRIMINO_LENGTH);
+    }
+
+    // 底部4行只差最左一列，其上还有几行要在消行后下移，竖直的I骨板已经落在那一列的底部，再下落一次就坠地并消去4行
+    // 不消行的模板则把I骨板放在第二列的顶上
+    clear_template = create_new_game(DEFAULT_WELL_WIDTH, DEFAULT_WELL_HEIGHT, SEED, RANDOMIZER_BAG);
+    if (!clear_template) {
+        return;
+    }
+    for (Coordinate y = 0; y < MAX_TETRIMINO_LENGTH; y++) {
+        fill_row_except(clear_template, y, 0);
+    }
+    fill_rows(clear_template, MAX_TETRIMINO_LENGTH, CROWDED_ROWS, &random);
+    Tetrimino i_piece = {BLOCK_TYPE_NORMAL_MIN, 0, 0, 0};
+    clear_template->current = i_piece;
+    template_size = game_info_size(clear_template->width, clear_template->height);
+    lock_template = malloc(template_size);
+    scratch_game = malloc(template_size);
+    if (lock_template) {
+        memcpy(lock_template, clear_template, template_size);
+        lock_template->current.x = 1;
+        lock_template->current.y = *column_height(lock_template, 1);
+    }
+
+    wide_template = create_new_game(WIDE_WIDTH, WIDE_HEIGHT, SEED, RANDOMIZER_BAG);
+    if (!wide_template) {
+        return;
+    }
+    for (Coordinate y = 0; y < MAX_TETRIMINO_LENGTH; y++) {
+        fill_row_except(wide_template, y, 0);
+    }
+    fill_rows(wide_template, MAX_TETRIMINO_LENGTH, CROWDED_ROWS, &random);
+    wide_template->current = i_piece;
+    wide_size = game_info_size(WIDE_WIDTH, WIDE_HEIGHT);
+    wide_scratch = malloc(wide_size);
+    wide_locked = malloc(wide_size);
+    if (wide_locked) {
+        memcpy(wide_locked, wide_template, wide_size);
+        for (Coordinate y = 0; y < MAX_TETRIMINO_LENGTH; y++) {
+            set_well_block(wide_locked, 0, y, i_piece.type);
+        }
+    }
+}
+
+
+static void bench_shift(uint64_t iterations) {
+    uint64_t moved = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        Tetrimino tetrimino = positions[i % POSITION_COUNT];
+        moved += shift_tetrimino(crowded_game, &tetrimino, i & 1 ? 1 : -1, 0);
+    }
+    sink += moved;
+}
+
+static void bench_rotate(uint64_t iterations) {
+    uint64_t rotated = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        Tetrimino tetrimino = positions[i % POSITION_COUNT];
+        rotated += rotate_tetrimino(crowded_game, &tetrimino);
+    }
+    sink += rotated;
+}
+
+static void bench_drop_distance(uint64_t iterations) {
+    uint64_t distance = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        Tetrimino tetrimino = positions[i % POSITION_COUNT];
+        tetrimino.y = crowded_game->height;
+        distance += drop_distance(crowded_game, &tetrimino);
+    }
+    sink += distance;
+}
+
+// 复制模板的开销，从下面两项中减去即是坠地本身的开销
+static void bench_copy_template(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        memcpy(scratch_game, lock_template, template_size);
+        sink += scratch_game->count;
+    }
+}
+
+static void bench_lock(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        memcpy(scratch_game, lock_template, template_size);
+        sink += step_game(scratch_game, ACTION_DOWN).flags;
+    }
+}
+
+static void bench_lock_clear(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        memcpy(scratch_game, clear_template, template_size);
+        sink += step_game(scratch_game, ACTION_DOWN).full_count;
+    }
+}
+
+// 与上面两项相同，但使用编译期特化的规则
+static void bench_lock_specialized(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        memcpy(scratch_game, lock_template, template_size);
+        sink += specialized_step(scratch_game, ACTION_DOWN).flags;
+    }
+}
+
+static void bench_lock_clear_specialized(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        memcpy(scratch_game, clear_template, template_size);
+        sink += specialized_step(scratch_game, ACTION_DOWN).full_count;
+    }
+}
+
+// 拥挤的游戏池中依次尝试平移、旋转和快速下降，分别使用通用的和特化的规则
+static void run_moves(StepFunction step, uint64_t iterations) {
+    static const Action actions[] = {ACTION_LEFT, ACTION_ROTATE, ACTION_RIGHT, ACTION_FAST_DOWN};
+    Tetrimino saved = crowded_game->current;
+    uint64_t flags = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        crowded_game->current = positions[i % POSITION_COUNT];
+        crowded_game->current.y = crowded_game->height;
+        flags += step(crowded_game, actions[i % 4]).flags;
+    }
+    crowded_game->current = saved;
+    sink += flags;
+}
+
+static void bench_moves(uint64_t iterations) {
+    run_moves(step_game, iterations);
+}
+
+static void bench_moves_specialized(uint64_t iterations) {
+    run_moves(specialized_step, iterations);
+}
+
+// 宽游戏池中I骨板坠地后的扫描：4个满行，以及其上的各行直到第一个空行，逐行判断满行和空行
+static void bench_wide_scan_rows(uint64_t iterations) {
+    RowScan scan;
+    for (uint64_t i = 0; i < iterations; i++) {
+        scan_rows(wide_locked, 0, MAX_TETRIMINO_LENGTH, true, &scan);
+        sink += scan.top;
+    }
+}
+
+static void bench_wide_copy_template(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        memcpy(wide_scratch, wide_template, wide_size);
+        sink += wide_scratch->count;
+    }
+}
+
+// 完整的一步：复制模板、坠地、扫描、压缩、更新各列高度并产生新骨板，减去wide_copy_template即为step_game的耗时
+static void bench_wide_lock_clear(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        memcpy(wide_scratch, wide_template, wide_size);
+        sink += step_game(wide_scratch, ACTION_DOWN).full_count;
+    }
+}
+
+static void bench_generate(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        generate_new_tetrimino(crowded_game);
+    }
+    sink += crowded_game->current.type;
+}
+
+
+// 输入的按键，一半是方向键的转义序列
+static const char keys[] = "\x1B[A\x1B[B\x1B[C\x1B[Dwasd \x1BOA\x1BOD\x10";
+
+// 每次写入一批按键后逐个取出，操作数是get_action返回的动作数，包含了读取管道的系统调用
+static void bench_get_action(uint64_t iterations) {
+    int fds[2];
+    int saved_stdin = dup(STDIN_FILENO);
+    if (pipe(fds) || saved_stdin < 0) {
+        return;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    dup2(fds[0], STDIN_FILENO);
+    uint64_t count = 0;
+    while (count < iterations) {
+        ssize_t written = write(fds[1], keys, sizeof(keys) - 1);
+        (void) written;
+        Action action;
+        while (count < iterations && (action = get_action(0)) != ACTION_EMPTY) {
+            sink += action;
+            count++;
+        }
+    }
+    // 取出剩下的，以免留到下一次运行
+    while (get_action(0) != ACTION_EMPTY);
+    dup2(saved_stdin, STDIN_FILENO);
+    close(saved_stdin);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+
+// 清屏后重绘整个画面，和开始一局或者载入进度时一样
+static void bench_full_render(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        init_display(crowded_game);
+        redraw_info_panel(crowded_game);
+        end_frame();
+    }
+}
+
+// 当前骨板左右来回移动，与start_game中每个动作之后的重绘一样
+static void bench_incremental_render(uint64_t iterations) {
+    GameInfo *game = crowded_game;
+    game->current = positions[0];
+    game->current.y = game->height;
+    game->previous = game->current;
+    Tetrimino ghost = game->current;
+    redraw_ghost(game, &ghost);
+    end_frame();
+    for (uint64_t i = 0; i < iterations; i++) {
+        Coordinate offset = i & 1 ? 1 : -1;
+        if (!shift_tetrimino(game, &game->current, offset, 0)) {
+            shift_tetrimino(game, &game->current, -offset, 0);
+        }
+        draw_single_tetrimino(game, &game->previous, false);
+        redraw_ghost(game, &ghost);
+        draw_single_tetrimino(game, &game->current, true);
+        game->previous = game->current;
+        end_frame();
+    }
+}
+
+
+static const Benchmark benchmarks[] = {
+        {"shift_tetrimino", bench_shift, false},
+        {"rotate_tetrimino", bench_rotate, false},
+        {"drop_distance", bench_drop_distance, false},
+        {"copy_template", bench_copy_template, false},
+        {"lock", bench_lock, false},
+        {"lock_clear_4_rows", bench_lock_clear, false},
+        {"lock_specialized", bench_lock_specialized, false},
+        {"lock_clear_4_rows_specialized", bench_lock_clear_specialized, false},
+        {"step_moves", bench_moves, false},
+        {"step_moves_specialized", bench_moves_specialized, false},
+        {"wide_scan_rows_scalar", bench_wide_scan_rows, false, "scalar"},
+        {"wide_scan_rows_avx2", bench_wide_scan_rows, false, "avx2"},
+        {"wide_copy_template", bench_wide_copy_template, false},
+        {"wide_lock_clear_4_rows_scalar", bench_wide_lock_clear, false, "scalar"},
+        {"wide_lock_clear_4_rows_avx2", bench_wide_lock_clear, false, "avx2"},
+        {"generate_new_tetrimino", bench_generate, false},
+        {"get_action", bench_get_action, false},
+        {"full_render", bench_full_render, true},
+        {"incremental_render", bench_incremental_render, true},
+};
+
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t time_run(const Benchmark *benchmark, uint64_t iterations) {
+    uint64_t start = get_monotonic_time();
+    benchmark->run(iterations);
+    return get_monotonic_time() - start;
+}
+
+static void run_benchmark(const Benchmark *benchmark, FILE *report) {
+    if (benchmark->kernel && !select_row_kernel(benchmark->kernel)) {
+        fprintf(report, "%-30s %12s\n", benchmark->name, "unsupported");
+        return;
+    }
+    // 试运行，迭代次数每次翻倍，直到耗时足以估计
+    uint64_t iterations = 1;
+    uint64_t elapsed;
+    while ((elapsed = time_run(benchmark, iterations)) < MIN_TIME / 10 && iterations < (1ull << 40)) {
+        iterations *= 2;
+    }
+    iterations = (uint64_t) ((double) iterations * MIN_TIME / (elapsed ? elapsed : 1)) + 1;
+
+    double times[REPETITIONS];
+    OutputStats before, after;
+    get_output_stats(&before);
+    for (int i = 0; i < REPETITIONS; i++) {
+        times[i] = (double) time_run(benchmark, iterations) / iterations;
+    }
+    get_output_stats(&after);
+    qsort(times, REPETITIONS, sizeof(double), compare_double);
+
+    fprintf(report, "%-30s %12.1f %12.1f %12"PRIu64, benchmark->name, times[REPETITIONS / 2], times[0], iterations);
+    if (benchmark->draws) {
+        fprintf(report, " %14.1f", (double) (after.bytes - before.bytes) / iterations / REPETITIONS);
+    }
+    fprintf(report, "\n");
+    select_row_kernel(NULL);
+}
+
+
+int main(int argc, char *argv[]) {
+    // 可以指定名字中的子串，只运行匹配的基准
+    const char *filter = argc > 1 ? argv[1] : "";
+    init_row_kernels();
+    prepare_games();
+    if (!crowded_game || !clear_template || !lock_template || !scratch_game || !wide_template || !wide_scratch ||
+        !wide_locked) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+
+    // 结果输出到原来的标准输出，绘制的输出则丢弃
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (!report || null_fd < 0) {
+        fprintf(stderr, "无法重定向标准输出\n");
+        return 1;
+    }
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    prepare_console();
+
+    fprintf(report, "%-30s %12s %12s %12s %14s\n", "benchmark", "ns/op", "min ns/op", "iterations", "bytes/frame");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        if (strstr(benchmarks[i].name, filter)) {
+            run_benchmark(&benchmarks[i], report);
+            fflush(report);
+        }
+    }
+
+    restore_console();
+    fclose(report);
+    free(crowded_game);
+    free(clear_template);
+    free(lock_template);
+    free(scratch_game);
+    free(wide_template);
+    free(wide_scratch);
+    free(wide_locked);
+    return 0;
+}
@@ -0,0 +1,259 @@
+extern "C" {
+#include "tetris.h"
+#include "rowscan.h"
+#include "trace.h"
+}
+#include "board.h"
+
+#include <cstring>
+
+
+// 与tetris.c中的规则逐条对应，区别只在于游戏池的宽高是模板参数：
+// 行数、每行位图的字数、方块数组的大小都是编译期常量，一行只有一个字时跨字的处理整个消失，
+// 逐个方块、逐行的循环次数固定为BLOCKS_PER_TETRIMINO和MAX_TETRIMINO_LENGTH，编译器可以完全展开
+// 找出满行和整段移动各行与tetris.c共用rowscan.c，消行的结果不会与通用版本不一致
+
+namespace {
+
+template<Coordinate W, Coordinate H>
+class Board {
+public:
+    // 游戏池的总行数、每行位图的字数，以及最后一个字中属于游戏池的位
+    static constexpr Coordinate ROWS = H + MAX_TETRIMINO_LENGTH;
+    static constexpr size_t WORDS = (W + ROW_BITS - 1) / ROW_BITS;
+    static constexpr RowBits LAST_WORD_MASK = W % ROW_BITS ? ((RowBits) 1 << W % ROW_BITS) - 1 : ~(RowBits) 0;
+    // 与well_blocks_size相同，方块数组的大小向上取整，使位图相对于GameInfo的起始地址对齐
+    static constexpr size_t BLOCKS_SIZE =
+            (offsetof(GameInfo, well) + sizeof(BlockType) * W * ROWS + sizeof(RowBits) - 1) / sizeof(RowBits)
+            * sizeof(RowBits) - offsetof(GameInfo, well);
+
+    static_assert(W >= MAX_TETRIMINO_LENGTH && W <= MAX_WELL_WIDTH, "游戏池宽度超出范围");
+    static_assert(H >= MAX_TETRIMINO_LENGTH && H <= MAX_WELL_HEIGHT, "游戏池高度超出范围");
+
+    explicit Board(GameInfo *game)
+            : game(game),
+              blocks(reinterpret_cast<BlockType (*)[W]>(game->well)),
+              rows(reinterpret_cast<RowBits (*)[WORDS]>(game->well + BLOCKS_SIZE)),
+              heights(reinterpret_cast<Coordinate *>(rows + ROWS)) {}
+
+    // 这一大小的GameInfo的内存布局是否与tetris.h中的一致，不一致时不能使用特化版本
+    static bool matches_layout() {
+        return well_blocks_size(W, H) == BLOCKS_SIZE && row_word_count(W) == WORDS &&
+               game_info_size(W, H) == offsetof(GameInfo, well) + BLOCKS_SIZE
+                                       + sizeof(RowBits) * WORDS * ROWS + sizeof(Coordinate) * W;
+    }
+
+    StepEvents step(Action action) {
+        StepEvents events = {0};
+        bool moved = false;
+        Tetrimino *current = &game->current;
+        switch (action) {
+            case ACTION_LEFT:
+                TRACE_SPAN("shift_tetrimino") {
+                    moved = shift(current, -1, 0);
+                }
+                break;
+            case ACTION_RIGHT:
+                TRACE_SPAN("shift_tetrimino") {
+                    moved = shift(current, 1, 0);
+                }
+                break;
+            case ACTION_ROTATE:
+                TRACE_SPAN("rotate_tetrimino") {
+                    moved = rotate(current);
+                }
+                break;
+            case ACTION_DOWN:
+                TRACE_SPAN("shift_tetrimino") {
+                    moved = shift(current, 0, -1);
+                }
+                if (!moved) {
+                    TRACE_SPAN("lock_tetrimino") {
+                        lock(&events);
+                    }
+                }
+                break;
+            case ACTION_FAST_DOWN: {
+                Coordinate distance = drop_distance(current);
+                if (distance > 0) {
+                    current->y -= distance;
+                    moved = true;
+                } else {
+                    TRACE_SPAN("lock_tetrimino") {
+                        lock(&events);
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        if (moved) {
+            events.flags |= EVENT_MOVED;
+        }
+        return events;
+    }
+
+private:
+    GameInfo *game;
+    BlockType (*blocks)[W];
+    RowBits (*rows)[WORDS];
+    Coordinate *heights;
+
+    bool collides(const Tetrimino *tetrimino, Coordinate x, Coordinate y) const {
+        const TetriminoShape *shape = tetrimino_shape(tetrimino);
+        if (x < 0 || y < 0 || x + shape->width > W || y + shape->height > ROWS) {
+            return true;
+        }
+        const RowBits *row = rows[y] + x / ROW_BITS;
+        int shift = x % ROW_BITS;
+        for (int r = 0; r < MAX_TETRIMINO_LENGTH; r++) {
+            if (r >= shape->height) {
+                break;
+            }
+            RowBits bits = shape->rows[r];
+            if (row[r * WORDS] & bits << shift) {
+                return true;
+            }
+            // 只有一个字时骨板不可能跨字，这一段在编译期就去掉了
+            if (WORDS > 1 && shift > ROW_BITS - MAX_TETRIMINO_LENGTH &&
+                (row[r * WORDS + 1] & bits >> (ROW_BITS - shift))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool shift(Tetrimino *tetrimino, Coordinate offset_x, Coordinate offset_y) const {
+        if (collides(tetrimino, tetrimino->x + offset_x, tetrimino->y + offset_y)) {
+            return false;
+        }
+        tetrimino->x += offset_x;
+        tetrimino->y += offset_y;
+        return true;
+    }
+
+    bool rotate(Tetrimino *tetrimino) const {
+        Tetrimino tmp = *tetrimino;
+        tmp.rotation = (tmp.rotation + 1) % 4;
+        for (int i = 0; i < ROTATION_KICK_COUNT; i++) {
+            if (shift(&tmp, rotation_kicks[i][0], rotation_kicks[i][1])) {
+                *tetrimino = tmp;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Coordinate drop_distance(const Tetrimino *tetrimino) const {
+        const TetriminoShape *shape = tetrimino_shape(tetrimino);
+        Coordinate landing = 0;
+        for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
+            Coordinate y = heights[tetrimino->x + shape->block_x[i]] - shape->block_y[i];
+            if (y > landing) {
+                landing = y;
+            }
+        }
+        if (landing <= tetrimino->y) {
+            return tetrimino->y - landing;
+        }
+        Coordinate y = tetrimino->y;
+        while (!collides(tetrimino, tetrimino->x, y - 1)) {
+            y--;
+        }
+        return tetrimino->y - y;
+    }
+
+    bool row_empty(Coordinate y) const {
+        RowBits bits = 0;
+        for (size_t i = 0; i < WORDS; i++) {
+            bits |= rows[y][i];
+        }
+        return !bits;
+    }
+
+    void lower_column_height(Coordinate x) {
+        RowBits bit = (RowBits) 1 << (x % ROW_BITS);
+        while (heights[x] > 0 && !(rows[heights[x] - 1][x / ROW_BITS] & bit)) {
+            heights[x]--;
+        }
+    }
+
+    // 与tetris.c相同，只有最高方块在最高的满行中的列要往下找
+    void remove_full_rows(const StepEvents *events) {
+        compact_rows(game, events->cleared_rows, events->full_count, events->dirty_top);
+        Coordinate lowered = events->cleared_rows[events->full_count - 1] + 1 - events->full_count;
+        for (Coordinate x = 0; x < W; x++) {
+            heights[x] -= events->full_count;
+            if (heights[x] == lowered) {
+                lower_column_height(x);
+            }
+        }
+    }
+
+    void lock(StepEvents *events) {
+        Tetrimino *current = &game->current;
+        const TetriminoShape *shape = tetrimino_shape(current);
+        for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
+            Coordinate x = current->x + shape->block_x[i];
+            Coordinate y = current->y + shape->block_y[i];
+            blocks[y][x] = current->type;
+            rows[y][x / ROW_BITS] |= (RowBits) 1 << (x % ROW_BITS);
+            if (heights[x] <= y) {
+                heights[x] = y + 1;
+            }
+        }
+        events->flags |= EVENT_LOCKED;
+
+        RowScan scan;
+        Coordinate full_top = current->y + shape->height < H ? current->y + shape->height : H;
+        scan_rows(game, current->y, full_top, false, &scan);
+        if (scan.full_count) {
+            events->full_count = scan.full_count;
+            std::memcpy(events->cleared_rows, scan.full_rows, sizeof(Coordinate) * scan.full_count);
+            events->dirty_bottom = scan.full_rows[0];
+            events->dirty_top = scan.top;
+            TRACE_SPAN("remove_full_rows") {
+                remove_full_rows(events);
+            }
+            events->flags |= EVENT_LINES_CLEARED;
+            game->scores += events->full_count * (events->full_count + 1) / 2;
+        }
+
+        game->count++;
+        generate_new_tetrimino(game);
+        if (!row_empty(H)) {
+            events->flags |= EVENT_GAME_OVER;
+        }
+    }
+};
+
+
+template<Coordinate W, Coordinate H>
+StepEvents step_board(GameInfo *game, Action action) {
+    return Board<W, H>(game).step(action);
+}
+
+
+// 有特化版本的大小，按需在这里增加
+const struct {
+    Coordinate width;
+    Coordinate height;
+    StepFunction step;
+    bool (*matches_layout)();
+} specializations[] = {
+        {DEFAULT_WELL_WIDTH, DEFAULT_WELL_HEIGHT,
+         step_board<DEFAULT_WELL_WIDTH, DEFAULT_WELL_HEIGHT>, Board<DEFAULT_WELL_WIDTH, DEFAULT_WELL_HEIGHT>::matches_layout},
+};
+
+}
+
+
+StepFunction select_step_function(Coordinate width, Coordinate height) {
+    for (const auto &specialization : specializations) {
+        if (specialization.width == width && specialization.height == height && specialization.matches_layout()) {
+            return specialization.step;
+        }
+    }
+    return step_game;
+}
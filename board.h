@@ -0,0 +1,25 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+// 编译期特化的游戏规则：board.cpp中的Board<W, H>模板在编译期就知道游戏池的宽高，
+// 各行位图的字数、方块数组的大小等都是常量，逐行、逐个方块的循环可以完全展开
+// 它直接读写GameInfo中的游戏池，内存布局与tetris.c中的完全一致，行为也与step_game完全一致，
+// 同一局游戏中可以和tetris.c中的其他函数混用，例如自动游戏的搜索、撤销重做以及保存进度
+// 只有几种常用的大小有特化的版本，其余大小使用step_game本身
+
+#include "tetris.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// 按游戏池大小选出step_game的实现，没有特化版本的大小返回step_game
+StepFunction select_step_function(Coordinate width, Coordinate height);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,213 @@
+#include "display.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <stdarg.h>
+#include <wchar.h>
+
+
+// 游戏池外边距
+#define WELL_MARGIN             1
+// 右侧信息面板外边距，以及为其保留的宽度，字符数
+#define PANEL_MARGIN            2
+#define PANEL_WIDTH             44
+// 当前骨板离视野边缘不到这么多格时滚动视野
+#define SCROLL_MARGIN           2
+
+
+// 视野，即屏幕上显示的那部分游戏池，左下角为(view_x, view_y)，共view_width列view_height行
+// 游戏池不比屏幕大时就是整个游戏池加上顶部的EXTRA_VISIBLE行，否则跟随当前骨板滚动，只绘制其中的方块
+// 视野的左右和下方总是画着墙壁作为边框
+static Coordinate view_x, view_y, view_width, view_height;
+
+
+// 设置输出光标位置，注意其与set_cursor_absolute_position的不同
+// 前者以游戏池左下第一个方块为坐标原点，后者以控制台左上角为坐标原点
+// 前者右上为坐标正方向，后者右下
+// 前者以2个字符为1个单位坐标（因为方块是2字符宽度），后者1字符1坐标
+static inline void set_cursor(Coordinate x, Coordinate y) {
+    set_cursor_absolute_position(
+            2 * (x - view_x + WALL_THICKNESS + WELL_MARGIN),
+            view_height - 1 - (y - view_y));
+}
+
+// 设置输出光标到信息面板中，column同样以2个字符为单位，line从底部往上数
+// 视野不比面板矮时面板与视野底部对齐，否则从屏幕顶部开始，面板的每一行都在屏幕内
+static inline void set_panel_cursor(Coordinate column, Coordinate line) {
+    set_cursor_absolute_position(
+            2 * (view_width + 2 * (WALL_THICKNESS + WELL_MARGIN) + PANEL_MARGIN + column),
+            (view_height > INFO_PANEL_LINES ? view_height : INFO_PANEL_LINES) - 1 - line);
+}
+
+static inline bool in_view(Coordinate x, Coordinate y) {
+    return x >= view_x && x < view_x + view_width && y >= view_y && y < view_y + view_height;
+}
+
+
+// 在右侧信息面板的某一行输出信息文本，格式化输出
+void printf_at_info_panel(GameInfo *game, Coordinate line, const char *format, ...) {
+    set_panel_cursor(0, line);
+    clear_color();
+    va_list args;
+    va_start(args, format);
+    vprint_text(format, args);
+    va_end(args);
+}
+
+// 同上，但进行非格式化输出
+static void print_at_info_panel(GameInfo *game, Coordinate line, const wchar_t *info) {
+    printf_at_info_panel(game, line, "%ls", info);
+}
+
+
+// 用指定种类的方块绘制游戏池中的一个骨板，视野以外的方块不绘制
+static void draw_tetrimino_blocks(GameInfo *game, Tetrimino *tetrimino, BlockType type) {
+    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
+        Coordinate x = tetrimino->x + tetrimino_shape(tetrimino)->block_x[i];
+        Coordinate y = tetrimino->y + tetrimino_shape(tetrimino)->block_y[i];
+        if (in_view(x, y)) {
+            set_cursor(x, y);
+            print_block(type);
+        }
+    }
+}
+
+void draw_single_tetrimino(GameInfo *game, Tetrimino *tetrimino, bool positive) {
+    draw_tetrimino_blocks(game, tetrimino, positive ? tetrimino->type : BLOCK_TYPE_NULL);
+}
+
+// 绘制/擦除信息面板中第index个预报骨板
+static void draw_forecast(Tetrimino *tetrimino, int index, bool positive) {
+    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
+        set_panel_cursor(index * (MAX_TETRIMINO_LENGTH + 1) + tetrimino_shape(tetrimino)->block_x[i],
+                         12 + tetrimino_shape(tetrimino)->block_y[i]);
+        print_block(positive ? tetrimino->type : BLOCK_TYPE_NULL);
+    }
+}
+
+
+// 擦除原来的虚影，绘制当前骨板直接落下后所在位置的虚影，之后需要重新绘制当前骨板，以免被虚影覆盖
+void redraw_ghost(GameInfo *game, Tetrimino *ghost) {
+    draw_tetrimino_blocks(game, ghost, BLOCK_TYPE_NULL);
+    *ghost = game->current;
+    ghost->y -= drop_distance(game, ghost);
+    draw_tetrimino_blocks(game, ghost, BLOCK_TYPE_GHOST);
+}
+
+
+// 在信息面板上显示到目前为止的统计概要
+void redraw_stats(GameInfo *game) {
+    for (int i = 0; i < STATS_SUMMARY_LINES; i++) {
+        char summary[64];
+        format_stats_summary(summary, sizeof(summary), i);
+        printf_at_info_panel(game, 8 - i, "%-44s", summary);
+    }
+}
+
+
+// 当新的骨板产生后，会要重绘右侧信息区域，包括预报和得分等
+void redraw_info_panel(GameInfo *game) {
+    for (int f = 0; f < FORECAST_COUNT; f++) {
+        draw_forecast(&game->forecasts[f], f, false);
+        draw_forecast(&game->forecasts[f + 1], f, true);
+    }
+
+    printf_at_info_panel(game, 10, "%ls: \t%"PRIu32, L"得分", game->scores);
+    printf_at_info_panel(game, 9, "%ls: \t%"PRIu32, L"数量", game->count);
+}
+
+
+// 重绘游戏池中[bottom, top)这几行在视野中的方块，不包括两侧的墙壁
+void redraw_well_rows(GameInfo *game, Coordinate bottom, Coordinate top) {
+    if (bottom < view_y) {
+        bottom = view_y;
+    }
+    if (top > view_y + view_height) {
+        top = view_y + view_height;
+    }
+    for (Coordinate y = bottom; y < top; y++) {
+        set_cursor(view_x, y);
+        for (Coordinate x = view_x; x < view_x + view_width; x++) {
+            print_block(y >= game->height ? BLOCK_TYPE_NULL : *well_block(game, x, y));
+        }
+    }
+}
+
+
+// 重绘视野中的全部方块以及作为边框的墙壁
+void redraw_well(GameInfo *game) {
+    for (Coordinate y = view_y - WALL_THICKNESS; y < view_y + view_height; y++) {
+        set_cursor(view_x - WALL_THICKNESS, y);
+        for (Coordinate x = view_x - WALL_THICKNESS; x < view_x + view_width + WALL_THICKNESS; x++) {
+            bool wall = x < view_x || x >= view_x + view_width || y < view_y;
+            print_block(wall ? BLOCK_TYPE_WALL : y >= game->height ? BLOCK_TYPE_NULL : *well_block(game, x, y));
+        }
+    }
+    // 只显示了一部分时，给出视野的范围
+    if (view_width < game->width || view_height < game->height + EXTRA_VISIBLE) {
+        printf_at_info_panel(game, 11, "%ls: \t%d-%d, %d-%d    ", L"视野", view_x, view_x + view_width - 1,
+                             view_y, view_y + view_height - 1);
+    }
+}
+
+
+// 在[low, high]中选一个最接近value的值
+static Coordinate clamp(Coordinate value, Coordinate low, Coordinate high) {
+    return value < low ? low : value > high ? high : value;
+}
+
+// 把视野移到以当前骨板为中心的位置，但不超出游戏池
+static void center_view(GameInfo *game) {
+    Coordinate center_x = game->current.x + MAX_TETRIMINO_LENGTH / 2;
+    Coordinate center_y = game->current.y + MAX_TETRIMINO_LENGTH / 2;
+    view_x = clamp(center_x - view_width / 2, 0, game->width - view_width);
+    view_y = clamp(center_y - view_height / 2, 0, game->height + EXTRA_VISIBLE - view_height);
+}
+
+
+bool scroll_to_tetrimino(GameInfo *game) {
+    // 当前骨板的包围盒，以及它离视野边缘的余量，视野已经到了游戏池边上的那一侧不需要余量
+    Tetrimino *current = &game->current;
+    Coordinate left = current->x - (view_x > 0 ? SCROLL_MARGIN : 0);
+    Coordinate right = current->x + MAX_TETRIMINO_LENGTH + (view_x + view_width < game->width ? SCROLL_MARGIN : 0);
+    Coordinate bottom = current->y - (view_y > 0 ? SCROLL_MARGIN : 0);
+    Coordinate top = current->y + MAX_TETRIMINO_LENGTH +
+                     (view_y + view_height < game->height + EXTRA_VISIBLE ? SCROLL_MARGIN : 0);
+    if (left >= view_x && right <= view_x + view_width && bottom >= view_y && top <= view_y + view_height) {
+        return false;
+    }
+    // 每次滚动都重绘整个视野，移到中间可以让下一次滚动尽量晚些到来
+    Coordinate old_x = view_x, old_y = view_y;
+    center_view(game);
+    if (view_x == old_x && view_y == old_y) {
+        return false;
+    }
+    TRACE_SPAN("redraw_well") {
+        redraw_well(game);
+    }
+    return true;
+}
+
+
+// 初始化显示，按控制台大小确定视野，清屏并输出一些固定文字
+void init_display(GameInfo *game) {
+    Coordinate columns, rows;
+    get_console_size(&columns, &rows);
+    Coordinate width = columns / 2 - 2 * (WALL_THICKNESS + WELL_MARGIN) - (2 * PANEL_MARGIN + PANEL_WIDTH) / 2;
+    Coordinate height = rows - WALL_THICKNESS;
+    view_width = clamp(width, MAX_TETRIMINO_LENGTH, game->width);
+    view_height = clamp(height, MAX_TETRIMINO_LENGTH, game->height + EXTRA_VISIBLE);
+    center_view(game);
+
+    clear_screen();
+    print_at_info_panel(game, 6, L"WSAD/方向键 旋转平移");
+    print_at_info_panel(game, 5, L"空格/回车 快速下降");
+    print_at_info_panel(game, 4, L"ctrl+P 暂停");
+    print_at_info_panel(game, 3, L"ctrl+W/R 保存/载入进度");
+    print_at_info_panel(game, 2, L"ctrl+U/E 撤销/重做");
+    print_at_info_panel(game, 1, L"ctrl+N 重新开始");
+    print_at_info_panel(game, 0, L"ctrl+C 退出");
+    TRACE_SPAN("redraw_well") {
+        redraw_well(game);
+    }
+}
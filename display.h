@@ -0,0 +1,48 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+// 游戏画面的绘制：游戏池在左，信息面板在右，都通过platform.h的绘制函数输出
+// 坐标以游戏池左下第一个方块为原点，右上为正，与tetris.h一致
+// 游戏池比控制台大时只显示跟随当前骨板的一个视野，视野以外的方块都不绘制
+
+#include "platform.h"
+#include "tetris.h"
+
+
+// 游戏池顶部额外可见行数
+#define EXTRA_VISIBLE           2
+
+// 信息面板的行数，从下往上数，预报在第12行起，最上面一行ALERT_LINE用于提示信息
+#define INFO_PANEL_LINES        19
+#define ALERT_LINE              (INFO_PANEL_LINES - 1)
+
+
+// 在右侧信息面板的某一行输出信息文本，格式化输出
+void printf_at_info_panel(GameInfo *game, Coordinate line, const char *format, ...);
+
+// 绘制/擦除游戏池中的单个骨板
+void draw_single_tetrimino(GameInfo *game, Tetrimino *tetrimino, bool positive);
+
+// 擦除原来的虚影，绘制当前骨板直接落下后所在位置的虚影，之后需要重新绘制当前骨板，以免被虚影覆盖
+void redraw_ghost(GameInfo *game, Tetrimino *ghost);
+
+// 在信息面板上显示到目前为止的统计概要
+void redraw_stats(GameInfo *game);
+
+// 当新的骨板产生后，会要重绘右侧信息区域，包括预报和得分等
+void redraw_info_panel(GameInfo *game);
+
+// 重绘游戏池中[bottom, top)这几行在视野中的方块，不包括两侧的墙壁
+void redraw_well_rows(GameInfo *game, Coordinate bottom, Coordinate top);
+
+// 重绘视野中的全部方块以及作为边框的墙壁
+void redraw_well(GameInfo *game);
+
+// 当前骨板接近视野边缘时把视野移到以它为中心的位置并重绘，返回是否滚动了
+// 滚动后需要重新绘制虚影和当前骨板
+bool scroll_to_tetrimino(GameInfo *game);
+
+// 初始化显示，按控制台大小确定视野，清屏并输出一些固定文字
+void init_display(GameInfo *game);
+
+#endif
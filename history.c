@@ -0,0 +1,194 @@
+#include "history.h"
+#include "rowscan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// 一次坠地的变化
+typedef struct {
+    // 坠地的骨板，以及它刚产生时的forecasts[0]
+    Tetrimino locked;
+    Tetrimino spawned;
+    // 产生新骨板之前的随机数发生器和袋
+    Random random;
+    uint8_t bag_count;
+    BlockType bag[TETRIMINO_SHAPE_COUNT];
+    uint32_t scores;
+    // 被消除的各行，从下往上，其方块（不含坠地的骨板）保存在rows中这一记录对应的位置
+    int full_count;
+    Coordinate cleared_rows[MAX_TETRIMINO_LENGTH];
+} HistoryEntry;
+
+struct History {
+    size_t capacity;
+    // 环形缓冲中最早的记录的位置，记录的个数，以及其中尚未撤销的个数，之后的可以重做
+    size_t first;
+    size_t count;
+    size_t position;
+    HistoryEntry *entries;
+    // 每条记录MAX_TETRIMINO_LENGTH行，每行width格，按游戏池的宽度分配
+    BlockType *rows;
+    Coordinate width;
+};
+
+
+History *create_history(size_t capacity) {
+    History *history = calloc(1, sizeof(History));
+    if (!history) {
+        return NULL;
+    }
+    history->capacity = capacity ? capacity : 1;
+    if (!(history->entries = malloc(sizeof(HistoryEntry) * history->capacity))) {
+        free(history);
+        return NULL;
+    }
+    return history;
+}
+
+
+void destroy_history(History *history) {
+    free(history->entries);
+    free(history->rows);
+    free(history);
+}
+
+
+void clear_history(History *history) {
+    history->first = history->count = history->position = 0;
+}
+
+
+static HistoryEntry *entry_at(History *history, size_t index) {
+    return &history->entries[(history->first + index) % history->capacity];
+}
+
+static BlockType *entry_rows(History *history, HistoryEntry *entry) {
+    return history->rows + (size_t) (entry - history->entries) * MAX_TETRIMINO_LENGTH * history->width;
+}
+
+
+// 按游戏池的宽度准备保存各行的缓冲，宽度变了则清空历史，失败返回false
+static bool prepare_rows(History *history, GameInfo *game) {
+    if (history->rows && history->width == game->width) {
+        return true;
+    }
+    clear_history(history);
+    free(history->rows);
+    history->rows = malloc(sizeof(BlockType) * history->capacity * MAX_TETRIMINO_LENGTH * game->width);
+    history->width = history->rows ? game->width : 0;
+    return history->rows != NULL;
+}
+
+// 在末尾加入一条记录，之后可以重做的记录都被丢弃，满了则丢弃最早的一条
+static HistoryEntry *push_entry(History *history) {
+    history->count = history->position;
+    if (history->count == history->capacity) {
+        history->first = (history->first + 1) % history->capacity;
+        history->count--;
+    }
+    history->position = ++history->count;
+    return entry_at(history, history->count - 1);
+}
+
+
+StepEvents step_game_recorded(History *history, GameInfo *game, Action action) {
+    // 只有落不下去时的下落和快速下降才会坠地
+    Tetrimino *current = &game->current;
+    if ((action != ACTION_DOWN && action != ACTION_FAST_DOWN) || drop_distance(game, current) > 0) {
+        return step_game(game, action);
+    }
+    if (!prepare_rows(history, game)) {
+        return step_game(game, action);
+    }
+
+    HistoryEntry *entry = push_entry(history);
+    entry->locked = *current;
+    entry->spawned = game->forecasts[0];
+    entry->random = game->random;
+    entry->bag_count = game->bag_count;
+    memcpy(entry->bag, game->bag, sizeof(entry->bag));
+    entry->scores = game->scores;
+    // 与lock_tetrimino一样，只有骨板所在的几行可能被填满，在坠地之前先保存这几行，之后只留下真正被消除的
+    const TetriminoShape *shape = tetrimino_shape(current);
+    BlockType *rows = entry_rows(history, entry);
+    size_t row_size = sizeof(BlockType) * game->width;
+    for (int r = 0; r < shape->height && current->y + r < game->height; r++) {
+        memcpy(rows + r * game->width, well_block(game, 0, current->y + r), row_size);
+    }
+    StepEvents events = step_game(game, action);
+    entry->full_count = events.full_count;
+    for (int i = 0; i < events.full_count; i++) {
+        entry->cleared_rows[i] = events.cleared_rows[i];
+        memmove(rows + i * game->width, rows + (events.cleared_rows[i] - entry->locked.y) * game->width, row_size);
+    }
+    return events;
+}
+
+
+int undo_piece(History *history, GameInfo *game) {
+    if (history->position == 0 || history->width != game->width) {
+        return -1;
+    }
+    HistoryEntry *entry = entry_at(history, --history->position);
+    int full_count = entry->full_count;
+
+    // 把被消除的行插回原处，其上各行上移，与remove_full_rows相反；上移的各行只到第一个空行为止
+    if (full_count) {
+        RowScan scan;
+        scan_rows(game, entry->cleared_rows[0], entry->cleared_rows[0], true, &scan);
+        expand_rows(game, entry->cleared_rows, full_count, scan.top);
+        const BlockType *rows = entry_rows(history, entry);
+        for (int i = 0; i < full_count; i++) {
+            Coordinate y = entry->cleared_rows[i];
+            RowBits *row = well_row(game, y);
+            memcpy(well_block(game, 0, y), rows + i * game->width, sizeof(BlockType) * game->width);
+            for (size_t j = 0; j < game->row_words; j++) {
+                row[j] = row_word_mask(game->width, j);
+            }
+        }
+    }
+
+    // 移除坠地的骨板，被消除的行中它的那些格子也一并移除
+    Tetrimino *locked = &entry->locked;
+    const TetriminoShape *shape = tetrimino_shape(locked);
+    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
+        set_well_block(game, locked->x + shape->block_x[i], locked->y + shape->block_y[i], BLOCK_TYPE_NULL);
+    }
+
+    // 各列最高的方块或者是上移了的，或者在插回的行中，从两者的上限开始往下找
+    for (Coordinate x = 0; x < game->width; x++) {
+        Coordinate *height = column_height(game, x);
+        if (full_count) {
+            *height += full_count;
+            if (*height <= entry->cleared_rows[full_count - 1]) {
+                *height = entry->cleared_rows[full_count - 1] + 1;
+            }
+        }
+        while (*height > 0 && !well_occupied(game, x, *height - 1)) {
+            (*height)--;
+        }
+    }
+
+    // 新产生的骨板退回预报之外，坠地的骨板回到刚产生时的位置
+    memmove(&game->forecasts[1], &game->forecasts[0], sizeof(game->forecasts[0]) * FORECAST_COUNT);
+    game->forecasts[0] = entry->spawned;
+    spawn_tetrimino(game);
+    game->random = entry->random;
+    game->bag_count = entry->bag_count;
+    memcpy(game->bag, entry->bag, sizeof(game->bag));
+    game->scores = entry->scores;
+    game->count--;
+    return full_count;
+}
+
+
+int redo_piece(History *history, GameInfo *game) {
+    if (history->position == history->count || history->width != game->width) {
+        return -1;
+    }
+    // 随机数发生器和袋都已经恢复，在原处再坠地一次，产生的新骨板也与原来的相同
+    HistoryEntry *entry = entry_at(history, history->position++);
+    game->current = entry->locked;
+    return step_game(game, ACTION_DOWN).full_count;
+}
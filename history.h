@@ -0,0 +1,35 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+// 撤销与重做：每次骨板坠地时记下这一次的变化，包括坠地的骨板、被消除的各行、得分以及产生新骨板之前随机数发生器和袋的状态，
+// 撤销时据此把游戏恢复到这个骨板刚产生时的样子，重做时再让它在原处坠地，都只涉及改变了的格子，不用复制整个游戏池
+// 记录保存在容量固定的环形缓冲中，满了以后丢弃最早的，长时间游戏也不会占用更多内存
+
+#include "tetris.h"
+
+
+typedef struct History History;
+
+// 默认最多记录的坠地次数
+#define DEFAULT_HISTORY_CAPACITY    1024
+
+
+// 创建最多记录capacity次坠地的历史，失败返回NULL
+History *create_history(size_t capacity);
+
+void destroy_history(History *history);
+
+// 清空全部记录，开始新的一局或者载入进度之后调用
+void clear_history(History *history);
+
+// 与step_game相同，骨板坠地时把变化记入历史，之前撤销了的记录不能再重做
+// 内存不足时照常执行动作，但清空历史
+StepEvents step_game_recorded(History *history, GameInfo *game, Action action);
+
+// 撤销最近一次坠地，当前骨板回到它刚产生时的位置，返回那次坠地消除的行数，没有可以撤销的返回-1
+int undo_piece(History *history, GameInfo *game);
+
+// 重做最近一次撤销的坠地，返回消除的行数，没有可以重做的返回-1
+int redo_piece(History *history, GameInfo *game);
+
+#endif
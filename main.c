@@ -1,6 +1,15 @@
 #include "platform.h"
+#include "tetris.h"
+#include "rowscan.h"
+#include "display.h"
+#include "replay.h"
+#include "save.h"
+#include "autosave.h"
+#include "autoplay.h"
+#include "history.h"
+#include "stats.h"
+#include "trace.h"
 
-#include <stdarg.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <time.h>
@@ -11,241 +20,58 @@
 
 
 #define SAVE_FILE               "ConsoleTetris.dat"
+// 启用性能追踪时，退出时写入的文件
+#define TRACE_FILE              "ConsoleTetris.trace.json"
+// 信息面板上的统计最多每隔这么久更新一次，纳秒
+#define STATS_INTERVAL          500000000
+// 自动游戏默认的两次动作之间的间隔，毫秒
+#define DEFAULT_AUTOPLAY_TIME   100
+
+
+// 正在录制的录像，没有录制时为NULL
+static ReplayWriter *recording;
+// 正在回放的录像，此时动作都从录像中读取，不回放时为NULL
+static ReplayReader *playback;
+// 自动保存的最短间隔，纳秒，0表示不自动保存
+static uint64_t autosave_interval;
+static uint64_t last_autosave_time;
+// 自动游戏，不自动游戏时为NULL，以及其两次动作之间的间隔，纳秒
+static Autoplayer *autoplayer;
+static uint64_t autoplay_interval;
+// 本局每次坠地的记录，用于撤销和重做
+static History *history;
+// 是否统计性能并在信息面板上显示
+static bool show_stats;
+// 信息面板上的统计上次更新的时间，统计本身的输出也会被计入，所以不逐帧更新
+static uint64_t last_stats_time;
+// 收到了SIGINT或者SIGTERM，信号处理函数中只设置这个标志，由游戏循环正常退出
+static volatile sig_atomic_t quit_requested;
 
-// 每个骨板有4个方块，最长/宽也就是4
-#define BLOCKS_PER_TETRIMINO    4
-#define MAX_TETRIMINO_LENGTH    BLOCKS_PER_TETRIMINO
-
-// 每行可以行动15次，到达次数后下降一行
-#define FRAME_PER_ROW           15
-// 2个预报
-#define FORECAST_COUNT          2
-
-// 游戏池顶部额外可见行数
-#define EXTRA_VISIBLE           2
-// 墙壁厚度
-#define WALL_THICKNESS          1
-// 游戏池外边距
-#define WELL_MARGIN             1
-// 右侧信息面板外边距
-#define PANEL_MARGIN            2
-
-
-// 单个骨板的数据结构，包括其种类和各个方块的坐标
-typedef struct {
-    BlockType type;
-    Coordinate x[BLOCKS_PER_TETRIMINO];
-    Coordinate y[BLOCKS_PER_TETRIMINO];
-} Tetrimino;
-
-
-// 不同形状的骨板
-const Tetrimino initial_tetriminos[] = {
-        {BLOCK_TYPE_NULL, {0, 0, 0, 0}, {3, 2, 1, 0}}, // I
-        {BLOCK_TYPE_NULL, {0, 1, 1, 0}, {1, 1, 0, 0}}, // O
-        {BLOCK_TYPE_NULL, {0, 1, 2, 1}, {1, 1, 1, 0}}, // T
-        {BLOCK_TYPE_NULL, {1, 1, 1, 0}, {2, 1, 0, 0}}, // J
-        {BLOCK_TYPE_NULL, {0, 0, 0, 1}, {2, 1, 0, 0}}, // L
-        {BLOCK_TYPE_NULL, {2, 1, 1, 0}, {1, 1, 0, 0}}, // S
-        {BLOCK_TYPE_NULL, {0, 1, 1, 2}, {1, 1, 0, 0}}  // Z
-};
-
-
-// 保存游戏全部信息的结构体，可以用来保存恢复进度
-typedef struct {
-    Tetrimino previous;
-    Tetrimino current;
-    Tetrimino forecasts[FORECAST_COUNT + 1];
-    uint32_t scores;
-    uint32_t count;
-    Coordinate width;
-    Coordinate height;
-    BlockType well[];
-} GameInfo;
-
-
-// 利用坐标获取游戏池的方块了类型，以左下第一个非墙壁方块为坐标原点，右上为正
-static inline BlockType *well_block(GameInfo *game, Coordinate x, Coordinate y) {
-    return &game->well[(y + WALL_THICKNESS) * (game->width + 2 * WALL_THICKNESS)
-                       + x + WALL_THICKNESS];
-}
-
-
-// 计算游戏池某一行有多少方块
-Coordinate count_row(GameInfo *game, Coordinate y) {
-    Coordinate count = 0;
-    for (Coordinate x = 0; x < game->width; x++) {
-        count += *well_block(game, x, y) != BLOCK_TYPE_NULL;
-    }
-    return count;
-}
-
-
-// 设置输出光标位置，注意其与set_cursor_absolute_position的不同
-// 前者以游戏池左下第一个非墙壁方块为坐标原点，后者以控制台左上角为坐标原点
-// 前者右上为坐标正方向，后者右下
-// 前者以2个字符为1个单位坐标（因为方块是2字符宽度），后者1字符1坐标
-static inline void set_cursor(GameInfo *game, Coordinate x, Coordinate y) {
-    set_cursor_absolute_position(
-            2 * (x + WALL_THICKNESS + WELL_MARGIN),
-            game->height + EXTRA_VISIBLE - 1 - y);
-}
-
-
-// 在右侧信息面板的某一行输出信息文本，格式化输出
-static inline void printf_at_info_panel(GameInfo *game, Coordinate line, const char *format, ...) {
-    set_cursor(game, game->width + WALL_THICKNESS + WELL_MARGIN + PANEL_MARGIN, line);
-    clear_color();
-    va_list args;
-    va_start(args, format);
-    vprintf(format, args);
-    va_end(args);
-}
-
-// 同上，但进行非格式化输出
-static inline void print_at_info_panel(GameInfo *game, Coordinate line, const wchar_t *info) {
-    printf_at_info_panel(game, line, "%ls", info);
-}
 
 // 输出一条提示消息并暂停程序，按任意键后继续
 void alert_message(GameInfo *game, const wchar_t *info) {
-    printf_at_info_panel(game, 18, "%.40ls", info);
-    while (get_action(100) == ACTION_EMPTY);
-    printf_at_info_panel(game, 18, "%-40ls", L"");
-}
-
-
-// 绘制/擦除单个骨板，利用offset_*可以实现在游戏池或者预报区域进行绘制
-void draw_single_tetrimino(GameInfo *game, Tetrimino *tetrimino, bool positive,
-                           Coordinate offset_x, Coordinate offset_y) {
-    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
-        if (tetrimino->y[i] + offset_y < game->height + EXTRA_VISIBLE) {
-            set_cursor(game, tetrimino->x[i] + offset_x, tetrimino->y[i] + offset_y);
-            print_block(positive ? tetrimino->type : BLOCK_TYPE_NULL);
-        }
-    }
-}
-
-
-// 当新的骨板产生后，会要重绘右侧信息区域，包括预报和得分等
-void redraw_info_panel(GameInfo *game) {
-    Coordinate offset_x = game->width + WALL_THICKNESS + WELL_MARGIN + PANEL_MARGIN;
-    Coordinate offset_y = 12;
-    for (Coordinate f = 0; f < FORECAST_COUNT; f++) {
-        Coordinate this_offset_x = offset_x + f * (MAX_TETRIMINO_LENGTH + 1);
-        draw_single_tetrimino(game, &game->forecasts[f], false, this_offset_x, offset_y);
-        draw_single_tetrimino(game, &game->forecasts[f + 1], true, this_offset_x, offset_y);
-    }
-
-    printf_at_info_panel(game, 10, "%ls: \t%"PRIu32, L"得分", game->scores);
-    printf_at_info_panel(game, 9, "%ls: \t%"PRIu32, L"数量", game->count);
-}
-
-
-// 重绘游戏池中的全部方块
-void redraw_well(GameInfo *game) {
-    for (Coordinate y = -WALL_THICKNESS; y < game->height + EXTRA_VISIBLE; y++) {
-        set_cursor(game, -WALL_THICKNESS, y);
-        for (Coordinate x = -WALL_THICKNESS; x < game->width + WALL_THICKNESS; x++) {
-            print_block(y >= game->height ? BLOCK_TYPE_NULL : *well_block(game, x, y));
-        }
-    }
+    printf_at_info_panel(game, ALERT_LINE, "%.40ls", info);
+    stats_phase(STATS_PHASE_OUTPUT);
+    end_frame();
+    stats_phase(STATS_PHASE_WAIT);
+    while (get_action(100) == ACTION_EMPTY && !quit_requested);
+    stats_phase(STATS_PHASE_LOGIC);
+    printf_at_info_panel(game, ALERT_LINE, "%-40ls", L"");
 }
 
 
-// 初始化显示，清屏并输出一些固定文字
-void init_display(GameInfo *game) {
-    clear_screen();
-    print_at_info_panel(game, 6, L"WSAD/方向键 旋转平移");
-    print_at_info_panel(game, 5, L"空格/回车 快速下降");
-    print_at_info_panel(game, 4, L"ctrl+P 暂停");
-    print_at_info_panel(game, 3, L"ctrl+W 保存进度");
-    print_at_info_panel(game, 2, L"ctrl+R 载入进度");
-    print_at_info_panel(game, 1, L"ctrl+N 重新开始");
-    print_at_info_panel(game, 0, L"ctrl+C 退出");
-    // 很奇怪，这里不fflush会导致MAC下显示异常
-    fflush(stdout);
-    redraw_well(game);
+// 更新信息面板上的统计
+static void update_stats(GameInfo *game) {
+    redraw_stats(game);
+    last_stats_time = get_monotonic_time();
 }
 
 
-// 在指定方向轴以指定偏移量平移一个骨板，如果没“碰壁”返回true，否则false
-bool shift_tetrimino(GameInfo *game, Tetrimino *tetrimino, Coordinate *axis, Coordinate offset) {
-    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
-        axis[i] += offset;
-        Coordinate x = tetrimino->x[i];
-        Coordinate y = tetrimino->y[i];
-        if (game && *well_block(game, x, y) != BLOCK_TYPE_NULL) {
-            do {
-                axis[i] -= offset;
-            } while (i-- > 0);
-            return false;
-        }
-    }
-    return true;
-}
-
-
-// 逆时旋转骨板，同理返回布尔值表示是否可行
-bool rotate_tetrimino(GameInfo *game, Tetrimino *tetrimino) {
-    // 获取左上下三个边界的位置    
-    Coordinate left = tetrimino->x[0];
-    Coordinate bottom = tetrimino->y[0];
-    Coordinate top = tetrimino->y[0];
-    for (int i = 1; i < BLOCKS_PER_TETRIMINO; i++) {
-        left = tetrimino->x[i] < left ? tetrimino->x[i] : left;
-        bottom = tetrimino->y[i] < bottom ? tetrimino->y[i] : bottom;
-        top = tetrimino->y[i] > top ? tetrimino->y[i] : top;
-    }
-
-    // 旋转
-    Tetrimino tmp;
-    tmp.type = tetrimino->type;
-    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
-        tmp.x[i] = left + (top - tetrimino->y[i]);
-        tmp.y[i] = bottom + (tetrimino->x[i] - left);
-    }
-
-    // 如果旋转后需要往左或者往下平移可以避免碰壁，这也是允许的，通俗地说就是“顶过去”
-    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
-        if (!game ||
-            shift_tetrimino(game, &tmp, tmp.x, -i) ||
-            shift_tetrimino(game, &tmp, tmp.y, -i)) {
-            *tetrimino = tmp;
-            return true;
-        }
-    }
-    return false;
-}
-
-
-// 产生一个新的骨板，从预报依次递补
-// 注意forecasts[0]始终与游戏池当前骨板一致，已经不是“预”报了，所以这个它其实是不会显示的
-void generate_new_tetrimino(GameInfo *game) {
-    memmove(&game->forecasts[0], &game->forecasts[1], sizeof(game->forecasts[0]) * FORECAST_COUNT);
-    BlockType choice = rand() % (sizeof(initial_tetriminos) / sizeof(initial_tetriminos[0]));
-    game->forecasts[FORECAST_COUNT] = initial_tetriminos[choice];
-    game->forecasts[FORECAST_COUNT].type = BLOCK_TYPE_NORMAL_MIN + choice;
-    for (int i = rand() % 4; i-- > 0;) {
-        rotate_tetrimino(NULL, &game->forecasts[FORECAST_COUNT]);
-    }
-    game->current = game->forecasts[0];
-    shift_tetrimino(NULL, &game->current, game->current.x, (game->width - MAX_TETRIMINO_LENGTH) / 2);
-    shift_tetrimino(NULL, &game->current, game->current.y, game->height);
-    game->previous = game->current;
-}
-
-
-// 保存进度
+// 保存进度，由后台线程写入文件，这里等待其完成
 bool save_game(GameInfo *game) {
     bool successful = false;
-    FILE *fp = fopen(SAVE_FILE, "w");
-    if (fp) {
-        uint32_t size = sizeof(GameInfo) + sizeof(BlockType) *
-                                           (game->width + 2 * WALL_THICKNESS) *
-                                           (game->height + MAX_TETRIMINO_LENGTH + WALL_THICKNESS);
-        successful = fwrite(&size, sizeof(uint32_t), 1, fp) && fwrite(game, size, 1, fp);
-        fclose(fp);
+    TRACE_SPAN("save_game") {
+        successful = save_game_now(game);
     }
     return successful;
 }
@@ -253,177 +79,410 @@ bool save_game(GameInfo *game) {
 
 // 载入进度
 GameInfo *load_game(void) {
-    GameInfo *game = NULL;
-    FILE *fp = fopen(SAVE_FILE, "r");
-    if (fp) {
-        uint32_t size;
-        if (fread(&size, sizeof(uint32_t), 1, fp)) {
-            if (!(game = malloc(size)) || !fread(game, size, 1, fp)) {
-                free(game);
-            }
-        }
-        fclose(fp);
-    }
-    return game;
-}
-
-
-// 初始化新游戏
-GameInfo *create_new_game(void) {
-    GameInfo *game;
-    Coordinate width = 10;
-    Coordinate height = 20;
-    size_t well_size = sizeof(BlockType) *
-                       (width + WALL_THICKNESS * 2) *
-                       (height + WALL_THICKNESS + MAX_TETRIMINO_LENGTH);
-
-    game = malloc(sizeof(GameInfo) + well_size);
-    game->scores = game->count = 0;
-    game->width = width;
-    game->height = height;
-    memset(game->well, BLOCK_TYPE_NULL, well_size);
-
-    // 游戏池墙壁绘制
-    for (Coordinate x = -WALL_THICKNESS; x < game->width + WALL_THICKNESS; x++) {
-        if (x < 0 || x >= game->width) {
-            for (Coordinate y = 0; y < game->height + MAX_TETRIMINO_LENGTH; y++) {
-                *well_block(game, x, y) = BLOCK_TYPE_WALL;
-            }
-        }
-        for (Coordinate y = 1; y <= WALL_THICKNESS; y++) {
-            *well_block(game, x, -y) = BLOCK_TYPE_WALL;
-        }
-    }
-
-    // 初始产生几个骨板，填满预报
-    for (int i = 0; i <= FORECAST_COUNT; i++) {
-        generate_new_tetrimino(game);
-    }
-    return game;
+    return load_game_file(SAVE_FILE);
 }
 
 
 // 进行游戏
 GameInfo *start_game(GameInfo *game) {
     init_display(game);
+    clear_history(history);
     // 每一次循环表示生成了一个新骨板进入了游戏池
     while (true) {
         // 放在判断语句前，可以保证redraw_info_panel被调用
-        redraw_info_panel(game);
-        // 判断是否游戏结束
-        if (count_row(game, game->height)) {
+        TRACE_SPAN("redraw_info_panel") {
+            redraw_info_panel(game);
+        }
+        if (show_stats) {
+            update_stats(game);
+        }
+        // 判断是否游戏结束，自动游戏时直接开始下一局，可以一直运行下去
+        if (is_game_over(game)) {
+            if (autoplayer) {
+                // 与按ctrl+N一样录制，回放时才能接着进行下一局
+                if (recording) {
+                    record_action(recording, ACTION_NEW_GAME, get_monotonic_time());
+                }
+                return create_next_game(game);
+            }
+            if (playback) {
+                // 游戏结束后录像中只能是开始新游戏，否则录像与规则不一致
+                Action action;
+                uint32_t delta;
+                if (!next_replay_action(playback, &action, &delta)) {
+                    alert_message(game, L"回放结束，按任意键退出");
+                } else if (action == ACTION_NEW_GAME) {
+                    return create_next_game(game);
+                } else {
+                    alert_message(game, L"录像与回放不一致，按任意键退出");
+                }
+                return NULL;
+            }
             alert_message(game, L"GAME OVER，按任意键退出");
             return NULL;
         }
-        draw_single_tetrimino(game, &game->current, true, 0, 0);
-
-        // 每一次循环代表一帧，每次可以行动一次，到达次数上限后会自动下落一行
-        for (int frame = 0; frame <= FRAME_PER_ROW; frame++) {
-            // 分数越大，时间越短
-            Action action = frame == FRAME_PER_ROW ? ACTION_DOWN :
-                            get_action(4000 / (100 + game->scores) + 30);
-            bool tetrimino_moved = false;
+        // 新骨板的虚影，原来的虚影与坠地的骨板重合，不用擦除；游戏池比屏幕大时视野先移到新骨板处
+        Tetrimino ghost = game->current;
+        scroll_to_tetrimino(game);
+        redraw_ghost(game, &ghost);
+        draw_single_tetrimino(game, &game->current, true);
+
+        // 每一次循环处理一个动作，玩家的输入随到随处理
+        // 自动下落按单调时钟计时，下落时刻只依次向后推移，不受处理和绘制耗时的影响
+        uint64_t fall_time = get_monotonic_time() + fall_interval(game);
+        StepEvents events = {0};
+        // 撤销或者重做了，当前骨板已经换了
+        bool rewound = false;
+        // 自动游戏在新骨板产生时选好落点，之后每隔一段时间移动一步
+        uint64_t autoplay_time = 0;
+        if (autoplayer) {
+            TRACE_SPAN("plan_placement") {
+                plan_placement(autoplayer, game);
+            }
+            autoplay_time = get_monotonic_time() + autoplay_interval;
+        }
+        while (!(events.flags & EVENT_LOCKED) && !rewound) {
+            // 等待输入之前，先把上一帧的绘制输出
+            stats_phase(STATS_PHASE_OUTPUT);
+            TRACE_SPAN("end_frame") {
+                end_frame();
+            }
+            stats_end_frame();
+            uint64_t now = get_monotonic_time();
+            Action action = ACTION_DOWN;
+            uint32_t delta;
+            if (playback) {
+                // 回放时不等待，以最快速度执行录像中的动作
+                if (!next_replay_action(playback, &action, &delta)) {
+                    alert_message(game, L"回放结束，按任意键退出");
+                    return NULL;
+                }
+            } else {
+                // 自动游戏时，到了下一步的时刻也要醒来，玩家的输入仍然照常处理
+                uint64_t wake_time = autoplayer && autoplay_time < fall_time ? autoplay_time : fall_time;
+                if (now < wake_time) {
+                    stats_phase(STATS_PHASE_WAIT);
+                    TRACE_SPAN("get_action") {
+                        action = get_action((uint32_t) ((wake_time - now + 999999) / 1000000));
+                    }
+                    stats_phase(STATS_PHASE_LOGIC);
+                    now = get_monotonic_time();
+                    if (action != ACTION_EMPTY) {
+                        stats_input(get_action_time());
+                    }
+                }
+                if (action == ACTION_EMPTY && autoplayer && now >= autoplay_time) {
+                    action = next_autoplay_action(autoplayer, game);
+                    autoplay_time = now + autoplay_interval;
+                    stats_input(now);
+                }
+                if (action == ACTION_EMPTY && now >= fall_time) {
+                    action = ACTION_DOWN;
+                }
+            }
+            // 按ctrl+C等退出，与游戏结束后退出一样进行收尾
+            if (quit_requested) {
+                return NULL;
+            }
+            // 只录制会改变游戏进程的动作，包括自动下落
+            if (recording && (action == ACTION_NEW_GAME ||
+                              (action >= ACTION_LEFT && action <= ACTION_ROTATE))) {
+                record_action(recording, action, now);
+            }
             GameInfo *loaded_game = NULL;
             switch (action) {
-                case ACTION_LEFT:
-                    tetrimino_moved = shift_tetrimino(game, &game->current, game->current.x, -1);
-                    break;
-                case ACTION_RIGHT:
-                    tetrimino_moved = shift_tetrimino(game, &game->current, game->current.x, 1);
-                    break;
-                case ACTION_ROTATE:
-                    tetrimino_moved = rotate_tetrimino(game, &game->current);
-                    break;
-                case ACTION_DOWN:
-                    tetrimino_moved = shift_tetrimino(game, &game->current, game->current.y, -1);
-                    frame = tetrimino_moved ? 0 : FRAME_PER_ROW;
-                    break;
-                case ACTION_FAST_DOWN:
-                    while (shift_tetrimino(game, &game->current, game->current.y, -1)) {
-                        tetrimino_moved = true;
-                    }
-                    frame = tetrimino_moved ? 0 : FRAME_PER_ROW;
-                    break;
                 case ACTION_PAUSE:
                     alert_message(game, L"游戏已暂停，按任意键继续");
-                    break;
+                    // 暂停的时间不算在内
+                    fall_time = get_monotonic_time() + fall_interval(game);
+                    continue;
                 case ACTION_SAVE:
                     alert_message(game, save_game(game) ?
                                         L"保存进度成功，按任意键继续" :
                                         L"保存进度失败，按任意键继续");
-                    break;
+                    fall_time = get_monotonic_time() + fall_interval(game);
+                    continue;
                 case ACTION_LOAD:
                     if ((loaded_game = load_game())) {
+                        // 载入的进度不是由录像开始的那一局而来，录像到此为止
+                        if (recording) {
+                            close_replay(recording);
+                            recording = NULL;
+                        }
                         alert_message(game, L"载入进度成功，按任意键开始");
                         return loaded_game;
-                    } else {
-                        alert_message(game, L"载入进度失败，按任意键开始");
                     }
-                    break;
+                    alert_message(game, L"载入进度失败，按任意键开始");
+                    fall_time = get_monotonic_time() + fall_interval(game);
+                    continue;
                 case ACTION_NEW_GAME:
-                    return create_new_game();
+                    return create_next_game(game);
+                case ACTION_QUIT:
+                    return NULL;
+                case ACTION_UNDO:
+                case ACTION_REDO:
+                    // 没有可以撤销或重做的就忽略，成功了才录制，回放时也一定成功
+                    if ((action == ACTION_UNDO ? undo_piece(history, game) : redo_piece(history, game)) >= 0) {
+                        if (recording) {
+                            record_action(recording, action, now);
+                        }
+                        rewound = true;
+                    }
+                    continue;
                 default:
                     break;
             }
 
+            TRACE_SPAN("step_game") {
+                events = step_game_recorded(history, game, action);
+            }
+            if (action == ACTION_DOWN && events.flags & EVENT_MOVED) {
+                // 到时自动下落的，下次下落时刻紧接着这次排定；玩家主动下落的，则从现在重新计时
+                fall_time = now >= fall_time ? fall_time + fall_interval(game) : now + fall_interval(game);
+            } else if (action == ACTION_FAST_DOWN) {
+                fall_time = now + fall_interval(game);
+            }
+
             // 如果移动了，重绘当前活动骨板，采取差量重绘法，先擦除旧的，在绘制新的，更加高效
-            if (tetrimino_moved) {
-                draw_single_tetrimino(game, &game->previous, false, 0, 0);
-                draw_single_tetrimino(game, &game->current, true, 0, 0);
+            if (events.flags & EVENT_MOVED) {
+                TRACE_SPAN("redraw_tetrimino") {
+                    draw_single_tetrimino(game, &game->previous, false);
+                    scroll_to_tetrimino(game);
+                    redraw_ghost(game, &ghost);
+                    draw_single_tetrimino(game, &game->current, true);
+                }
                 game->previous = game->current;
             }
+            if (show_stats && now - last_stats_time >= STATS_INTERVAL) {
+                update_stats(game);
+            }
         }
 
-        // 骨板坠地，置入游戏池
-        for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
-            *well_block(game, game->current.x[i], game->current.y[i]) = game->current.type;
+        // 整个游戏池和预报都可能变了，全部重绘
+        if (rewound) {
+            init_display(game);
+            continue;
         }
 
-        // 消行可得分
-        int full_count = 0;
-        for (Coordinate y = 0; y < game->height; y++) {
-            if (count_row(game, y) == game->width) {
-                full_count++;
-                memmove(well_block(game, -WALL_THICKNESS, y), well_block(game, -WALL_THICKNESS, y + 1),
-                        (game->width + 2 * WALL_THICKNESS) * (game->height + MAX_TETRIMINO_LENGTH - 1 - y));
-                memset(well_block(game, 0, game->height + MAX_TETRIMINO_LENGTH - 1),
-                       BLOCK_TYPE_NULL, game->width);
-                y--;
+        // 骨板已经坠地，消行后只需重绘下移了的那些行
+        if (events.flags & EVENT_LINES_CLEARED) {
+            TRACE_SPAN("redraw_well_rows") {
+                redraw_well_rows(game, events.dirty_bottom, events.dirty_top);
             }
         }
-        if (full_count) {
-            redraw_well(game);
-            game->scores += full_count * (full_count + 1) / 2;
-        }
 
-        // 产生新的骨板进入下一个循环
-        game->count++;
-        generate_new_tetrimino(game);
+        // 此时进度处于一个完整的状态，到时间了就交给后台线程自动保存
+        if (autosave_interval && !playback && !(events.flags & EVENT_GAME_OVER)) {
+            uint64_t now = get_monotonic_time();
+            if (now - last_autosave_time >= autosave_interval) {
+                TRACE_SPAN("autosave_game") {
+                    autosave_game(game);
+                }
+                last_autosave_time = now;
+            }
+        }
     }
 }
 
 
-// 被杀死前，先恢复控制台
+// 被杀死前要恢复控制台、写完录像和快照，这些都不能在信号处理函数中进行，只通知游戏循环退出
+// 等待输入的poll会被信号打断，最迟也在下一次自动下落时退出
 void signal_kill(int sig) {
-    restore_console();
-    exit(0);
+    quit_requested = 1;
+    (void) sig;
 }
 
 
-int main(void) {
+// 输出命令行用法，返回值作为进程的退出码
+static int print_usage(const char *program) {
+    fprintf(stderr, "用法: %s [--input-thread] [--seed N] [--bag] [--width N] [--height N] [--record FILE] [--autosave N]"
+                    " [--stats]\n"
+                    "       %s --autoplay [--autoplay-ms N] [--lookahead N] [--seed N] [--bag] [--width N] [--height N]"
+                    " [--record FILE] [--stats]\n"
+                    "       %s --replay FILE [--headless]\n"
+                    "  --input-thread  使用独立的线程读取输入\n"
+                    "  --seed N        指定随机种子，同一种子产生同样的骨板序列\n"
+                    "  --bag           7种骨板一袋，袋中依次取出\n"
+                    "  --width N       新游戏的游戏池宽度，%d到%d，默认%d，超出屏幕时视野跟随当前骨板滚动\n"
+                    "  --height N      新游戏的游戏池高度，%d到%d，默认%d\n"
+                    "  --record FILE   开始新游戏并录制到文件\n"
+                    "  --autosave N    骨板坠地时自动保存进度，最短间隔N秒\n"
+                    "  --autoplay      自动游戏，游戏结束后自动开始下一局\n"
+                    "  --autoplay-ms N 自动游戏两次动作之间的间隔，默认%d毫秒\n"
+                    "  --lookahead N   自动游戏最多考虑的预报骨板个数，0到%d，默认%d，游戏池较大时自动减少\n"
+                    "  --stats         统计输入延迟和绘制开销，在信息面板上显示，退出时输出详细结果\n"
+                    "  --replay FILE   以最快速度回放录像\n"
+                    "  --headless      回放时不显示，只输出统计结果\n",
+            program, program, program, MAX_TETRIMINO_LENGTH, MAX_WELL_WIDTH, DEFAULT_WELL_WIDTH,
+            MAX_TETRIMINO_LENGTH, MAX_WELL_HEIGHT, DEFAULT_WELL_HEIGHT,
+            DEFAULT_AUTOPLAY_TIME, MAX_LOOKAHEAD, MAX_LOOKAHEAD);
+    return 1;
+}
+
+
+int main(int argc, char *argv[]) {
+    // 命令行选项
+    bool input_thread = false;
+    bool seeded = false;
+    uint64_t seed = 0;
+    Randomizer randomizer = RANDOMIZER_UNIFORM;
+    uint64_t width = DEFAULT_WELL_WIDTH;
+    uint64_t height = DEFAULT_WELL_HEIGHT;
+    bool sized = false;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    bool headless = false;
+    bool autoplay = false;
+    uint64_t autoplay_time = DEFAULT_AUTOPLAY_TIME;
+    uint64_t lookahead = MAX_LOOKAHEAD;
+    for (int i = 1; i < argc; i++) {
+        char *end;
+        if (strcmp(argv[i], "--input-thread") == 0) {
+            input_thread = true;
+        } else if (strcmp(argv[i], "--bag") == 0) {
+            randomizer = RANDOMIZER_BAG;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], &end, 0);
+            if (!*argv[i] || *end) {
+                return print_usage(argv[0]);
+            }
+            seeded = true;
+        } else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+            width = strtoull(argv[++i], &end, 0);
+            if (!*argv[i] || *end || width < MAX_TETRIMINO_LENGTH || width > MAX_WELL_WIDTH) {
+                return print_usage(argv[0]);
+            }
+            sized = true;
+        } else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc) {
+            height = strtoull(argv[++i], &end, 0);
+            if (!*argv[i] || *end || height < MAX_TETRIMINO_LENGTH || height > MAX_WELL_HEIGHT) {
+                return print_usage(argv[0]);
+            }
+            sized = true;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--autosave") == 0 && i + 1 < argc) {
+            uint64_t seconds = strtoull(argv[++i], &end, 0);
+            if (!*argv[i] || *end || seconds > 86400) {
+                return print_usage(argv[0]);
+            }
+            // 0秒也表示每次坠地都保存
+            autosave_interval = seconds ? seconds * 1000000000 : 1;
+        } else if (strcmp(argv[i], "--autoplay") == 0) {
+            autoplay = true;
+        } else if (strcmp(argv[i], "--autoplay-ms") == 0 && i + 1 < argc) {
+            autoplay_time = strtoull(argv[++i], &end, 0);
+            if (!*argv[i] || *end || autoplay_time > 60000) {
+                return print_usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--lookahead") == 0 && i + 1 < argc) {
+            lookahead = strtoull(argv[++i], &end, 0);
+            if (!*argv[i] || *end || lookahead > MAX_LOOKAHEAD) {
+                return print_usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = true;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else {
+            return print_usage(argv[0]);
+        }
+    }
+    if ((headless && !replay_path) || (replay_path && (record_path || autoplay || sized))) {
+        return print_usage(argv[0]);
+    }
+    if (autoplay && !autoplay_supported((Coordinate) width, (Coordinate) height)) {
+        fprintf(stderr, "游戏池太大，无法自动游戏\n");
+        return 1;
+    }
+
+    // 在启动线程之前选好消行扫描的内核
+    init_row_kernels();
+
+    ReplayReader reader;
+    GameInfo *game = NULL;
+    if (replay_path) {
+        if (!open_replay(&reader, replay_path) || !(game = create_replay_game(&reader))) {
+            fprintf(stderr, "无法打开录像文件%s\n", replay_path);
+            return 1;
+        }
+        if (headless) {
+            // 不需要控制台，直接执行全部动作并统计
+            free(game);
+            ReplayResult result;
+            uint64_t start_time = get_monotonic_time();
+            play_replay(&reader, &result);
+            double elapsed = (get_monotonic_time() - start_time) / 1e9;
+            close_replay_reader(&reader);
+            printf("games: %"PRIu32", actions: %"PRIu64", pieces: %"PRIu32", lines: %"PRIu32
+                   ", scores: %"PRIu32", recorded: %.1fs\n",
+                   result.games, result.actions, result.pieces, result.lines, result.scores,
+                   result.duration / 1e3);
+            printf("elapsed: %.6fs, %.0f actions/s\n", elapsed, result.actions / (elapsed > 0 ? elapsed : 1e-9));
+            if (result.desynced) {
+                fprintf(stderr, "录像与回放不一致：游戏结束后仍有其他动作\n");
+                return 1;
+            }
+            return 0;
+        }
+        playback = &reader;
+    }
+    if (!seeded) {
+        seed = (uint64_t) time(NULL) ^ get_monotonic_time();
+    }
+
+    // 自动游戏的搜索用上全部处理器，线程池创建失败时就在游戏线程中搜索
+    ThreadPool *pool = NULL;
+    if (autoplay) {
+        pool = create_thread_pool(0);
+        if (!(autoplayer = create_autoplayer((int) lookahead, pool))) {
+            fprintf(stderr, "内存不足\n");
+            return 1;
+        }
+        autoplay_interval = autoplay_time * 1000000;
+    }
+    if (!(history = create_history(DEFAULT_HISTORY_CAPACITY))) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+
+    name_trace_thread("game");
     setlocale(LC_CTYPE, "");
     // 准备控制台
     prepare_console();
+    // 不支持时仍然在游戏线程中读取输入
+    if (input_thread) {
+        start_input_thread();
+    }
     // 信号处理
-    signal(SIGABRT, signal_kill);
     signal(SIGINT, signal_kill);
     signal(SIGTERM, signal_kill);
 
-    srand((unsigned) time(NULL));
+    if (show_stats) {
+        start_stats();
+    }
+
+    // 无论是否自动保存，保存都由后台线程进行
+    start_autosave(SAVE_FILE);
+    last_autosave_time = get_monotonic_time();
 
-    GameInfo *game = load_game();
-    if (!game) {
-        game = create_new_game();
+    // 指定了种子、大小或者要录制时总是开始新游戏，否则优先载入进度
+    if (!game && !seeded && !sized && !record_path) {
+        game = load_game();
+    }
+    if (!game && !(game = create_new_game((Coordinate) width, (Coordinate) height, seed, randomizer))) {
+        stop_autosave();
+        restore_console();
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+    if (record_path && !(recording = create_replay(record_path, game, get_monotonic_time()))) {
+        stop_autosave();
+        restore_console();
+        fprintf(stderr, "无法创建录像文件%s\n", record_path);
+        return 1;
     }
     // start_game返回NULL表示退出，返回GameInfo *表示载入该结构体中的游戏
     while (game) {
@@ -432,6 +491,25 @@ int main(void) {
         game = g;
     }
 
+    stop_autosave();
     restore_console();
+    write_trace(TRACE_FILE);
+    if (autoplayer) {
+        destroy_autoplayer(autoplayer);
+    }
+    if (pool) {
+        destroy_thread_pool(pool);
+    }
+    destroy_history(history);
+    if (playback) {
+        close_replay_reader(playback);
+    }
+    if (show_stats) {
+        print_stats(stdout);
+    }
+    if (recording && !close_replay(recording)) {
+        fprintf(stderr, "录像写入失败\n");
+        return 1;
+    }
     return 0;
 }
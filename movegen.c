@@ -0,0 +1,130 @@
+#include "movegen.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// 状态的坐标范围：x在[0, width)，y在[0, height + MAX_TETRIMINO_LENGTH)，骨板的坐标是其包围盒在游戏池中的左下角
+// 其余位置一定“碰壁”，见tetrimino_collides
+struct MoveGenerator {
+    Coordinate width;
+    Coordinate height;
+    int columns;
+    int rows;
+    size_t state_count;
+    // 到达过的状态，以及已经作为落点输出过的状态
+    uint64_t *visited;
+    uint64_t *placed;
+    // 广度优先搜索的队列，每个状态最多入队一次
+    Tetrimino *queue;
+    // 每种骨板每个朝向对应的、占据同样格子的最小朝向
+    uint8_t canonical_rotations[TETRIMINO_SHAPE_COUNT][4];
+};
+
+
+static size_t state_index(MoveGenerator *generator, const Tetrimino *tetrimino) {
+    return ((size_t) tetrimino->rotation * generator->rows + tetrimino->y) * generator->columns + tetrimino->x;
+}
+
+static bool test_bit(const uint64_t *bits, size_t index) {
+    return bits[index / 64] >> (index % 64) & 1;
+}
+
+static void set_bit(uint64_t *bits, size_t index) {
+    bits[index / 64] |= (uint64_t) 1 << (index % 64);
+}
+
+
+MoveGenerator *create_move_generator(Coordinate width, Coordinate height) {
+    MoveGenerator *generator = calloc(1, sizeof(MoveGenerator));
+    if (!generator) {
+        return NULL;
+    }
+    generator->width = width;
+    generator->height = height;
+    generator->columns = width;
+    generator->rows = height + MAX_TETRIMINO_LENGTH;
+    generator->state_count = (size_t) 4 * generator->columns * generator->rows;
+    size_t words = (generator->state_count + 63) / 64;
+    generator->visited = malloc(sizeof(uint64_t) * words);
+    generator->placed = malloc(sizeof(uint64_t) * words);
+    generator->queue = malloc(sizeof(Tetrimino) * generator->state_count);
+    if (!generator->visited || !generator->placed || !generator->queue) {
+        destroy_move_generator(generator);
+        return NULL;
+    }
+
+    for (int type = 0; type < TETRIMINO_SHAPE_COUNT; type++) {
+        for (int rotation = 0; rotation < 4; rotation++) {
+            int same = 0;
+            while (memcmp(tetrimino_shapes[type][same].rows, tetrimino_shapes[type][rotation].rows,
+                          sizeof(tetrimino_shapes[type][rotation].rows)) != 0) {
+                same++;
+            }
+            generator->canonical_rotations[type][rotation] = (uint8_t) same;
+        }
+    }
+    return generator;
+}
+
+
+void destroy_move_generator(MoveGenerator *generator) {
+    free(generator->visited);
+    free(generator->placed);
+    free(generator->queue);
+    free(generator);
+}
+
+
+size_t max_placement_count(MoveGenerator *generator) {
+    return generator->state_count;
+}
+
+
+// 状态没有到达过时入队，调用者保证其不碰壁
+static void visit(MoveGenerator *generator, const Tetrimino *tetrimino, size_t *tail) {
+    size_t index = state_index(generator, tetrimino);
+    if (!test_bit(generator->visited, index)) {
+        set_bit(generator->visited, index);
+        generator->queue[(*tail)++] = *tetrimino;
+    }
+}
+
+size_t generate_placements(MoveGenerator *generator, GameInfo *game, const Tetrimino *tetrimino,
+                           Tetrimino *placements) {
+    size_t words = (generator->state_count + 63) / 64;
+    memset(generator->visited, 0, sizeof(uint64_t) * words);
+    memset(generator->placed, 0, sizeof(uint64_t) * words);
+
+    size_t head = 0, tail = 0, count = 0;
+    visit(generator, tetrimino, &tail);
+    while (head < tail) {
+        Tetrimino state = generator->queue[head++];
+        Tetrimino next = state;
+        if (shift_tetrimino(game, &next, 0, -1)) {
+            visit(generator, &next, &tail);
+        } else {
+            // 不能再下落了，是一个落点；换成占据同样格子的最小朝向后去重
+            Tetrimino placement = state;
+            placement.rotation = generator->canonical_rotations[state.type - BLOCK_TYPE_NORMAL_MIN][state.rotation];
+            size_t index = state_index(generator, &placement);
+            if (!test_bit(generator->placed, index)) {
+                set_bit(generator->placed, index);
+                placements[count++] = placement;
+            }
+        }
+        next = state;
+        if (shift_tetrimino(game, &next, -1, 0)) {
+            visit(generator, &next, &tail);
+        }
+        next = state;
+        if (shift_tetrimino(game, &next, 1, 0)) {
+            visit(generator, &next, &tail);
+        }
+        next = state;
+        if (rotate_tetrimino(game, &next)) {
+            visit(generator, &next, &tail);
+        }
+    }
+    return count;
+}
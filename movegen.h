@@ -0,0 +1,27 @@
+#ifndef MOVEGEN_H
+#define MOVEGEN_H
+
+// 落点生成：从骨板的当前位置出发，按照游戏真正的规则（左移、右移、下落以及带“顶过去”的旋转）广度优先搜索
+// 全部能到达的状态，其中不能再下落的就是落点，可以在那里坠地
+// 到达过的(朝向, x, y)记录在位图中，每个状态只展开一次；占据同样格子的落点只算一个，例如O骨板的各个朝向
+
+#include "tetris.h"
+
+
+typedef struct MoveGenerator MoveGenerator;
+
+// 创建适用于指定大小游戏池的生成器，其中的缓冲可以反复使用，失败返回NULL
+// 同一个生成器同时只能在一个线程中使用
+MoveGenerator *create_move_generator(Coordinate width, Coordinate height);
+
+void destroy_move_generator(MoveGenerator *generator);
+
+// 落点数的上限，generate_placements的placements至少要有这么大
+size_t max_placement_count(MoveGenerator *generator);
+
+// 列出tetrimino在game中能到达的全部落点，写入placements，返回个数，顺序是确定的
+// game的大小必须与创建生成器时一致，tetrimino自身不能“碰壁”
+size_t generate_placements(MoveGenerator *generator, GameInfo *game, const Tetrimino *tetrimino,
+                           Tetrimino *placements);
+
+#endif
@@ -0,0 +1,385 @@
+#include "platform.h"
+#include "tetris.h"
+#include "rowscan.h"
+#include "movegen.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// 落点序列计数：从指定种子的新游戏开始，依次把每个骨板放到它能到达的每个落点，数出深度为N的不同落点序列有多少个
+// 骨板序列由本局的随机数发生器产生，各个分支中完全相同，所以同样的参数总是得到同样的数，可以用来检验移动规则的改动
+// 某个落点使游戏结束时，经过它的序列在更深处不再延伸，只在恰好是最后一步时计入
+// 最后一层只数落点个数而不真正坠地；前两层展开为任务，在线程池中并行计数
+
+
+#define DEFAULT_DEPTH           4
+#define MAX_DEPTH               16
+
+// 展开为任务的层数，深度不超过它时直接在调用者的线程中计数
+#define SPLIT_DEPTH             2
+
+
+typedef struct {
+    int depth;
+    uint64_t seed;
+    Randomizer randomizer;
+} PerftOptions;
+
+// 每个工作线程自己的生成器，以及每一层的游戏副本和落点
+typedef struct {
+    MoveGenerator *generator;
+    GameInfo *games[MAX_DEPTH];
+    Tetrimino *placements[MAX_DEPTH];
+} Worker;
+
+// 展开前两层得到的任务：在frontier[game]中放置第二个骨板到placement，之后再数depth层
+typedef struct {
+    size_t game;
+    Tetrimino placement;
+} PerftTask;
+
+typedef struct {
+    Worker *workers;
+    int worker_count;
+    size_t game_size;
+    int depth;
+    GameInfo **frontier;
+    size_t frontier_count;
+    PerftTask *tasks;
+    size_t task_count;
+    // 每个任务的计数以及坠地的次数，按任务顺序汇总，结果与线程数无关
+    uint64_t *counts;
+    uint64_t *locks;
+} Perft;
+
+
+// 在game的副本中把当前骨板放到placement坠地，游戏结束时返回false
+static bool place(GameInfo *next, GameInfo *game, size_t game_size, const Tetrimino *placement) {
+    memcpy(next, game, game_size);
+    next->current = *placement;
+    return !(step_game(next, ACTION_DOWN).flags & EVENT_GAME_OVER);
+}
+
+// 从game开始还有depth层的落点序列数，level是使用的副本和落点缓冲的层号，locks累计坠地次数
+static uint64_t count_sequences(Worker *worker, size_t game_size, GameInfo *game, int depth, int level,
+                                uint64_t *locks) {
+    Tetrimino *placements = worker->placements[level];
+    size_t count = generate_placements(worker->generator, game, &game->current, placements);
+    if (depth == 1) {
+        return count;
+    }
+    uint64_t total = 0;
+    GameInfo *next = worker->games[level];
+    for (size_t i = 0; i < count; i++) {
+        ++*locks;
+        if (place(next, game, game_size, &placements[i])) {
+            total += count_sequences(worker, game_size, next, depth - 1, level + 1, locks);
+        }
+    }
+    return total;
+}
+
+static void perft_task(void *context, size_t index, int worker) {
+    Perft *perft = context;
+    PerftTask *task = &perft->tasks[index];
+    Worker *own = &perft->workers[worker];
+    GameInfo *next = own->games[0];
+    perft->locks[index] = 1;
+    perft->counts[index] = 0;
+    if (place(next, perft->frontier[task->game], perft->game_size, &task->placement)) {
+        perft->counts[index] = count_sequences(own, perft->game_size, next, perft->depth - SPLIT_DEPTH, 1,
+                                               &perft->locks[index]);
+    }
+}
+
+
+static bool create_workers(Perft *perft, GameInfo *game, int depth) {
+    perft->workers = calloc(perft->worker_count, sizeof(Worker));
+    if (!perft->workers) {
+        return false;
+    }
+    for (int i = 0; i < perft->worker_count; i++) {
+        Worker *worker = &perft->workers[i];
+        if (!(worker->generator = create_move_generator(game->width, game->height))) {
+            return false;
+        }
+        for (int level = 0; level < depth; level++) {
+            worker->games[level] = malloc(perft->game_size);
+            worker->placements[level] = malloc(sizeof(Tetrimino) * max_placement_count(worker->generator));
+            if (!worker->games[level] || !worker->placements[level]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void destroy_workers(Perft *perft) {
+    for (int i = 0; perft->workers && i < perft->worker_count; i++) {
+        Worker *worker = &perft->workers[i];
+        if (worker->generator) {
+            destroy_move_generator(worker->generator);
+        }
+        for (int level = 0; level < MAX_DEPTH; level++) {
+            free(worker->games[level]);
+            free(worker->placements[level]);
+        }
+    }
+    free(perft->workers);
+}
+
+
+// 展开前两层，frontier是放置了第一个骨板后的各个局面，任务是其中第二个骨板的各个落点
+static bool split_tasks(Perft *perft, GameInfo *game, uint64_t *locks) {
+    Worker *worker = &perft->workers[0];
+    Tetrimino *roots = worker->placements[0];
+    size_t root_count = generate_placements(worker->generator, game, &game->current, roots);
+    perft->frontier = calloc(root_count ? root_count : 1, sizeof(GameInfo *));
+    if (!perft->frontier) {
+        return false;
+    }
+    size_t capacity = 0;
+    for (size_t i = 0; i < root_count; i++) {
+        GameInfo *next = malloc(perft->game_size);
+        if (!next) {
+            return false;
+        }
+        ++*locks;
+        if (!place(next, game, perft->game_size, &roots[i])) {
+            free(next);
+            continue;
+        }
+        perft->frontier[perft->frontier_count++] = next;
+
+        Tetrimino *placements = worker->placements[1];
+        size_t count = generate_placements(worker->generator, next, &next->current, placements);
+        if (perft->task_count + count > capacity) {
+            capacity = (perft->task_count + count) * 2;
+            PerftTask *tasks = realloc(perft->tasks, sizeof(PerftTask) * capacity);
+            if (!tasks) {
+                return false;
+            }
+            perft->tasks = tasks;
+        }
+        for (size_t j = 0; j < count; j++) {
+            perft->tasks[perft->task_count].game = perft->frontier_count - 1;
+            perft->tasks[perft->task_count].placement = placements[j];
+            perft->task_count++;
+        }
+    }
+    size_t size = perft->task_count ? perft->task_count : 1;
+    perft->counts = malloc(sizeof(uint64_t) * size);
+    perft->locks = malloc(sizeof(uint64_t) * size);
+    return perft->counts && perft->locks;
+}
+
+static void free_tasks(Perft *perft) {
+    for (size_t i = 0; i < perft->frontier_count; i++) {
+        free(perft->frontier[i]);
+    }
+    free(perft->frontier);
+    free(perft->tasks);
+    free(perft->counts);
+    free(perft->locks);
+    perft->frontier = NULL;
+    perft->frontier_count = 0;
+    perft->tasks = NULL;
+    perft->task_count = 0;
+    perft->counts = NULL;
+    perft->locks = NULL;
+}
+
+
+// 数出深度为depth的落点序列数，失败返回false
+static bool run_perft(Perft *perft, ThreadPool *pool, GameInfo *game, int depth, uint64_t *count, uint64_t *locks) {
+    *count = 0;
+    *locks = 0;
+    perft->depth = depth;
+    if (depth <= SPLIT_DEPTH) {
+        *count = count_sequences(&perft->workers[0], perft->game_size, game, depth, 0, locks);
+        return true;
+    }
+
+    bool successful = split_tasks(perft, game, locks);
+    if (successful) {
+        run_thread_pool(pool, perft->task_count, perft_task, perft);
+        for (size_t i = 0; i < perft->task_count; i++) {
+            *count += perft->counts[i];
+            *locks += perft->locks[i];
+        }
+    }
+    free_tasks(perft);
+    return successful;
+}
+
+
+// 旋转表的检验：按改为编译期生成之前的运行时算法重新算出全部朝向和“顶过去”的平移顺序，与tetris.c中的表逐项比较
+// 当时的初始形状，方块坐标以包围盒左下角为原点
+static const Coordinate legacy_shapes[TETRIMINO_SHAPE_COUNT][2][BLOCKS_PER_TETRIMINO] = {
+        {{0, 0, 0, 0}, {3, 2, 1, 0}}, // I
+        {{0, 1, 1, 0}, {1, 1, 0, 0}}, // O
+        {{0, 1, 2, 1}, {1, 1, 1, 0}}, // T
+        {{1, 1, 1, 0}, {2, 1, 0, 0}}, // J
+        {{0, 0, 0, 1}, {2, 1, 0, 0}}, // L
+        {{2, 1, 1, 0}, {1, 1, 0, 0}}, // S
+        {{0, 1, 1, 2}, {1, 1, 0, 0}}  // Z
+};
+
+// 当时的旋转：包围盒左下角不动，(x, y)变为(left + top - y, bottom + x - left)
+static void legacy_rotate(Coordinate *block_x, Coordinate *block_y) {
+    Coordinate left = block_x[0], bottom = block_y[0], top = block_y[0];
+    for (int i = 1; i < BLOCKS_PER_TETRIMINO; i++) {
+        left = block_x[i] < left ? block_x[i] : left;
+        bottom = block_y[i] < bottom ? block_y[i] : bottom;
+        top = block_y[i] > top ? block_y[i] : top;
+    }
+    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
+        Coordinate x = block_x[i];
+        block_x[i] = left + top - block_y[i];
+        block_y[i] = bottom + x - left;
+    }
+}
+
+// 与表中的一个朝向比较方块坐标、每行的位图以及包围盒大小，返回是否一致
+static bool same_shape(const TetriminoShape *shape, const Coordinate *block_x, const Coordinate *block_y) {
+    uint8_t rows[MAX_TETRIMINO_LENGTH] = {0};
+    Coordinate width = 0, height = 0;
+    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
+        if (shape->block_x[i] != block_x[i] || shape->block_y[i] != block_y[i]) {
+            return false;
+        }
+        rows[block_y[i]] |= 1u << block_x[i];
+        width = block_x[i] + 1 > width ? block_x[i] + 1 : width;
+        height = block_y[i] + 1 > height ? block_y[i] + 1 : height;
+    }
+    return memcmp(shape->rows, rows, sizeof(rows)) == 0 && shape->width == width && shape->height == height;
+}
+
+// 返回不一致的项数，逐项输出
+static int check_tables(void) {
+    int mismatches = 0;
+    for (int type = 0; type < TETRIMINO_SHAPE_COUNT; type++) {
+        Coordinate block_x[BLOCKS_PER_TETRIMINO], block_y[BLOCKS_PER_TETRIMINO];
+        memcpy(block_x, legacy_shapes[type][0], sizeof(block_x));
+        memcpy(block_y, legacy_shapes[type][1], sizeof(block_y));
+        // 转两整圈，第二圈检验转回原样之后仍然一致
+        for (int turn = 0; turn < 8; turn++) {
+            if (!same_shape(&tetrimino_shapes[type][turn % 4], block_x, block_y)) {
+                printf("shape %d rotation %d: mismatch\n", type, turn % 4);
+                mismatches++;
+            }
+            legacy_rotate(block_x, block_y);
+        }
+    }
+
+    // 当时依次尝试往左平移i格和往下平移i格，i从0到MAX_TETRIMINO_LENGTH - 1，i为0时两者相同只算一次
+    Coordinate kicks[2 * MAX_TETRIMINO_LENGTH][2];
+    int kick_count = 0;
+    for (int i = 0; i < MAX_TETRIMINO_LENGTH; i++) {
+        kicks[kick_count][0] = (Coordinate) -i;
+        kicks[kick_count++][1] = 0;
+        if (i > 0) {
+            kicks[kick_count][0] = 0;
+            kicks[kick_count++][1] = (Coordinate) -i;
+        }
+    }
+    if (kick_count != ROTATION_KICK_COUNT || memcmp(kicks, rotation_kicks, sizeof(rotation_kicks)) != 0) {
+        printf("rotation kicks: mismatch\n");
+        mismatches++;
+    }
+    printf("tables checked: %d shapes x 4 rotations, %d kicks, mismatches: %d\n",
+           TETRIMINO_SHAPE_COUNT, ROTATION_KICK_COUNT, mismatches);
+    return mismatches;
+}
+
+
+static int print_usage(const char *program) {
+    fprintf(stderr, "用法: %s [选项]\n"
+                    "  --depth N        数到第N层，从1开始每层输出一次，1到%d，默认%d\n"
+                    "  --seed N         游戏的种子，默认为0\n"
+                    "  --bag            7种骨板一袋，袋中依次取出\n"
+                    "  --threads N      线程数，默认为处理器个数\n"
+                    "  --check-tables   只检验旋转表与原来的运行时旋转算法是否一致，不一致时退出码为1\n",
+            program, MAX_DEPTH, DEFAULT_DEPTH);
+    return 1;
+}
+
+
+// 解析非负整数参数
+static bool parse_number(const char *text, uint64_t *value) {
+    char *end;
+    *value = strtoull(text, &end, 0);
+    return *text && *text != '-' && !*end;
+}
+
+
+int main(int argc, char *argv[]) {
+    PerftOptions options = {DEFAULT_DEPTH, 0, RANDOMIZER_UNIFORM};
+    uint64_t thread_count = 0;
+    for (int i = 1; i < argc; i++) {
+        // 带参数的选项，参数必须是非负整数
+        const char *option = argv[i];
+        uint64_t value = 0;
+        if (strcmp(option, "--depth") == 0 || strcmp(option, "--seed") == 0 || strcmp(option, "--threads") == 0) {
+            if (++i >= argc || !parse_number(argv[i], &value)) {
+                return print_usage(argv[0]);
+            }
+        }
+
+        if (strcmp(option, "--depth") == 0 && value >= 1 && value <= MAX_DEPTH) {
+            options.depth = (int) value;
+        } else if (strcmp(option, "--seed") == 0) {
+            options.seed = value;
+        } else if (strcmp(option, "--threads") == 0 && value <= 1024) {
+            thread_count = value;
+        } else if (strcmp(option, "--bag") == 0) {
+            options.randomizer = RANDOMIZER_BAG;
+        } else if (strcmp(option, "--check-tables") == 0) {
+            return check_tables() ? 1 : 0;
+        } else {
+            return print_usage(argv[0]);
+        }
+    }
+
+    // 在启动线程之前选好消行扫描的内核
+    init_row_kernels();
+    GameInfo *game = create_new_game(DEFAULT_WELL_WIDTH, DEFAULT_WELL_HEIGHT, options.seed, options.randomizer);
+    ThreadPool *pool = create_thread_pool((int) thread_count);
+    Perft perft = {0};
+    bool successful = game && pool;
+    if (successful) {
+        perft.worker_count = thread_pool_size(pool);
+        perft.game_size = game_info_size(game->width, game->height);
+        successful = create_workers(&perft, game, options.depth);
+    }
+    if (!successful) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+
+    printf("seed: %"PRIu64", randomizer: %s, threads: %d\n", options.seed,
+           options.randomizer == RANDOMIZER_BAG ? "bag" : "uniform", perft.worker_count);
+    printf("%-6s %16s %14s %10s %14s\n", "depth", "sequences", "locks", "seconds", "placements/s");
+    for (int depth = 1; depth <= options.depth && successful; depth++) {
+        uint64_t count, locks;
+        uint64_t start_time = get_monotonic_time();
+        successful = run_perft(&perft, pool, game, depth, &count, &locks);
+        double elapsed = (get_monotonic_time() - start_time) / 1e9;
+        // 每秒生成的落点数：最后一层的每个序列以及之前每次坠地各算一个
+        printf("%-6d %16"PRIu64" %14"PRIu64" %10.3f %14.0f\n", depth, count, locks, elapsed,
+               (count + locks) / (elapsed > 0 ? elapsed : 1e-9));
+        fflush(stdout);
+    }
+    if (!successful) {
+        fprintf(stderr, "内存不足\n");
+    }
+
+    destroy_workers(&perft);
+    destroy_thread_pool(pool);
+    write_trace("tetris-perft.trace.json");
+    free(game);
+    return successful ? 0 : 1;
+}
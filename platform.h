@@ -3,15 +3,21 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
 
 #define BLOCK_TYPE_NULL     0
 #define BLOCK_TYPE_WALL     1
 #define BLOCK_TYPE_NORMAL_MIN   2
+// 虚影，表示当前骨板直接落下后的位置，只用于显示
+#define BLOCK_TYPE_GHOST    0xFF
 
 typedef enum {
     ACTION_EMPTY,
     ACTION_LEFT, ACTION_RIGHT, ACTION_DOWN, ACTION_FAST_DOWN, ACTION_ROTATE,
     ACTION_PAUSE ,ACTION_SAVE, ACTION_LOAD, ACTION_NEW_GAME,
+    ACTION_UNDO, ACTION_REDO,
+    ACTION_QUIT,
     ACTION_UNRECOGNIZED
 } Action;
 
@@ -28,16 +34,57 @@ void restore_console(void);
 // 清屏
 void clear_screen(void);
 
+// 控制台可见部分的大小，以字符为单位，prepare_console之后才有效
+void get_console_size(Coordinate *width, Coordinate *height);
+
 // 绘制一个方块
 void print_block(BlockType type);
 
 // 清除颜色，输出文字前调用
 void clear_color(void);
 
+// 在光标处格式化输出文字
+void vprint_text(const char *format, va_list args);
+
 // 设置输出光标的位置
 void set_cursor_absolute_position(Coordinate x, Coordinate y);
 
-// 获取玩家动作，有wait_time毫秒的时间等待输入
+// 结束一帧绘制，将本帧的全部改动真正输出到控制台
+// 上面的绘制函数都可能只是先记录下来，调用这个函数后才保证显示出来
+void end_frame(void);
+
+// 向控制台输出的累计统计，用于衡量绘制开销
+typedef struct {
+    // 输出的字节数
+    uint64_t bytes;
+    // 移动光标的次数
+    uint64_t cursor_moves;
+    // 改变文字颜色的次数
+    uint64_t color_changes;
+} OutputStats;
+
+void get_output_stats(OutputStats *stats);
+
+// 获取玩家动作，最多等待wait_time毫秒，一有输入就立即返回，超时则返回ACTION_EMPTY，输入已经结束时返回ACTION_QUIT
 Action get_action(uint32_t wait_time);
 
+// 上一次get_action返回的动作到达的时间，与get_monotonic_time是同一时钟
+uint64_t get_action_time(void);
+
+// 启动一个独立的输入线程阻塞读取输入，之后get_action只需从其队列中取出动作
+// 返回false表示当前平台不支持或者启动失败，此时get_action仍然自行读取输入
+bool start_input_thread(void);
+
+// 获取单调时钟的当前时间，单位纳秒，只用于计算时间间隔
+uint64_t get_monotonic_time(void);
+
+// 将整个文件只读地映射到内存，返回其起始地址并在size中给出大小，失败或者文件为空返回NULL
+const void *map_file(const char *path, size_t *size);
+
+// 解除map_file的映射
+void unmap_file(const void *data, size_t size);
+
+// 先写入同目录下的临时文件并落盘，再改名替换path，中途崩溃或断电也不会损坏原来的文件
+bool write_file_atomically(const char *path, const void *data, size_t size);
+
 #endif
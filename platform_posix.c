@@ -1,18 +1,184 @@
+// glibc下wcwidth等函数需要
+#define _GNU_SOURCE
+
 #include "platform.h"
+#include "threads.h"
 
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <wchar.h>
+#include <poll.h>
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 
 #define ESC "\x1B["
 
+// 宽字符的右半部分不单独占有字形
+#define GLYPH_CONTINUATION  L'\0'
+// 控制台上的内容未知，下一帧必须重新输出
+#define GLYPH_UNKNOWN       ((wchar_t) -1)
+
+#define COLOR_DEFAULT       0
+
+// 屏幕缓冲中的一个字符单元
+typedef struct {
+    wchar_t glyph;
+    uint8_t color;
+} Cell;
+
 
 static int old_fcntl;
 static struct termios old_termios;
 static struct winsize console_size;
 
+// 双缓冲：back是正在绘制的这一帧，front是控制台上实际显示的内容
+static Cell *back_cells;
+static Cell *front_cells;
+static Coordinate cursor_x;
+static Coordinate cursor_y;
+static uint8_t draw_color;
+
+// 一帧的输出先攒在这里，end_frame时一次write出去
+static char *output;
+static size_t output_length;
+static size_t output_capacity;
+// 累计输出统计
+static OutputStats output_stats;
+
+// 读入但还没有解码的输入字节，转义序列可能被拆在两次读取之间
+static unsigned char input[64];
+static size_t input_length;
+// 输入字节的到达时间
+static uint64_t input_time;
+
+// 已经解码但还没有返回的动作，附带其到达时间
+typedef struct {
+    Action action;
+    uint64_t time;
+} TimedAction;
+
+// 单生产者单消费者的无锁环形队列，生产者负责读取和解码输入，消费者是get_action
+// 没有输入线程时两者是同一个线程；有输入线程时，生产者是输入线程，写入后通过wake_pipe唤醒消费者
+#define ACTION_QUEUE_CAPACITY   256
+static TimedAction action_queue[ACTION_QUEUE_CAPACITY];
+static atomic_size_t action_head;
+static atomic_size_t action_tail;
+static uint64_t last_action_time;
+
+// 标准输入已经结束（管道关闭、终端挂断等），之后不再等待输入，get_action总是返回ACTION_QUIT
+static atomic_bool input_closed;
+
+static bool input_thread_running;
+static void stop_input_thread(void);
+static Thread input_thread;
+static int wake_pipe[2];
+static int stop_pipe[2];
+
+// 控制台实际的光标位置和文字属性，用来省去多余的转义序列，-1表示未知
+static Coordinate terminal_x = -1;
+static Coordinate terminal_y = -1;
+static int terminal_color = -1;
+
+
+// 写出全部数据，标准输入输出可能是同一个被设为非阻塞的终端，所以要处理EAGAIN
+static void write_output(const char *data, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(STDOUT_FILENO, data + written, length - written);
+        if (n >= 0) {
+            written += n;
+            output_stats.bytes += n;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd fd = {STDOUT_FILENO, POLLOUT, 0};
+            poll(&fd, 1, -1);
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+}
+
+// 写出全部缓冲内容
+static void output_flush(void) {
+    write_output(output, output_length);
+    output_length = 0;
+}
+
+// 保证缓冲还能放下length字节，内存不足时返回false，原来的缓冲不变
+static bool output_reserve(size_t length) {
+    if (output_length + length > output_capacity) {
+        size_t capacity = (output_length + length) * 2;
+        char *grown = realloc(output, capacity);
+        if (!grown) {
+            return false;
+        }
+        output = grown;
+        output_capacity = capacity;
+    }
+    return true;
+}
+
+static void output_append(const char *data, size_t length) {
+    if (!output_reserve(length)) {
+        // 缓冲扩不了时先写出已有的内容，再直接写出这一段，输出的顺序不变，记录的光标位置也仍然正确
+        output_flush();
+        write_output(data, length);
+        return;
+    }
+    memcpy(output + output_length, data, length);
+    output_length += length;
+}
+
+static void output_printf(const char *format, ...) {
+    char buffer[64];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    output_append(buffer, (size_t) length);
+}
+
+static inline Cell *cell_at(Cell *cells, Coordinate x, Coordinate y) {
+    return &cells[y * console_size.ws_col + x];
+}
+
+static inline bool cell_equal(const Cell *a, const Cell *b) {
+    return a->glyph == b->glyph && a->color == b->color;
+}
+
+// 在光标处放置一个字符，并维护宽字符左右两半的一致性
+static void put_glyph(wchar_t glyph, uint8_t color, int width) {
+    if (cursor_y < 0 || cursor_y >= console_size.ws_row ||
+        cursor_x < 0 || cursor_x + width > console_size.ws_col) {
+        cursor_x += width;
+        return;
+    }
+    Cell *cell = cell_at(back_cells, cursor_x, cursor_y);
+    // 覆盖了某个宽字符的一半，另一半也就不存在了
+    if (cell[0].glyph == GLYPH_CONTINUATION && cursor_x > 0) {
+        cell[-1].glyph = L' ';
+    }
+    if (cursor_x + width < console_size.ws_col && cell[width].glyph == GLYPH_CONTINUATION) {
+        cell[width].glyph = L' ';
+    }
+    cell[0].glyph = glyph;
+    cell[0].color = color;
+    if (width == 2) {
+        cell[1].glyph = GLYPH_CONTINUATION;
+        cell[1].color = color;
+    }
+    cursor_x += width;
+}
+
 
 void prepare_console(void) {
     // 无回显，不需要回车
@@ -25,115 +191,568 @@ void prepare_console(void) {
     old_fcntl = fcntl(STDIN_FILENO, F_GETFL);
     fcntl(STDIN_FILENO, F_SETFL, old_fcntl | O_NONBLOCK);
 
+    // 获取控制台大小，不是终端时给一个常见的默认值
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &console_size);
+    if (console_size.ws_col == 0 || console_size.ws_row == 0) {
+        console_size.ws_col = 80;
+        console_size.ws_row = 24;
+    }
+    size_t cell_count = (size_t) console_size.ws_col * console_size.ws_row;
+    back_cells = malloc(sizeof(Cell) * cell_count);
+    front_cells = malloc(sizeof(Cell) * cell_count);
+    for (size_t i = 0; i < cell_count; i++) {
+        back_cells[i].glyph = L' ';
+        back_cells[i].color = COLOR_DEFAULT;
+        front_cells[i].glyph = GLYPH_UNKNOWN;
+    }
+
     // 无光标
-    printf(ESC"?25l");
+    output_printf(ESC"?25l");
     // POSIX清屏，这里的清屏和clear_screen作用不同，后者会填充空格来绘制背景颜色
-    printf(ESC"2J");
-    // 获取控制台大小
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &console_size);
+    output_printf(ESC"2J");
+    output_flush();
 }
 
 
 void restore_console(void) {
+    stop_input_thread();
+    end_frame();
     fcntl(STDIN_FILENO, F_SETFL, old_fcntl);
     tcsetattr(STDIN_FILENO, TCSANOW, &old_termios);
-    printf(ESC"?25h");
+    output_printf(ESC"?25h");
     // 到窗口左下角去，但要必须要输出一个换行才能恢复输出文本属性
-    set_cursor_absolute_position(0, console_size.ws_row - 1);
-    printf(ESC"0m\n");
+    output_printf(ESC"%d;1H", console_size.ws_row);
+    output_printf(ESC"0m\n");
+    output_flush();
 }
 
 
 void clear_screen(void) {
-    // 光标置于左上角，黑底白字无高亮用空格回车刷满屏幕
-    set_cursor_absolute_position(0, 0);
-    printf(ESC"0;37;40m");
-    for (int y = 0; y < console_size.ws_row; y++) {
-        for (int x = 0; x < console_size.ws_col; x++) {
-            printf(" ");
-        }
-        printf("\n");
+    // 黑底白字无高亮用空格刷满屏幕，并且认为控制台当前内容未知，下一帧全部重新输出
+    size_t cell_count = (size_t) console_size.ws_col * console_size.ws_row;
+    for (size_t i = 0; i < cell_count; i++) {
+        back_cells[i].glyph = L' ';
+        back_cells[i].color = COLOR_DEFAULT;
+        front_cells[i].glyph = GLYPH_UNKNOWN;
     }
+    set_cursor_absolute_position(0, 0);
+    draw_color = COLOR_DEFAULT;
+}
+
+
+void get_console_size(Coordinate *width, Coordinate *height) {
+    *width = (Coordinate) console_size.ws_col;
+    *height = (Coordinate) console_size.ws_row;
 }
 
 
 void print_block(BlockType type) {
     if (type == BLOCK_TYPE_NULL) {
-        printf(ESC"0;37;40m  ");
+        put_glyph(L' ', COLOR_DEFAULT, 1);
+        put_glyph(L' ', COLOR_DEFAULT, 1);
     } else if (type == BLOCK_TYPE_WALL) {
-        printf(ESC"0;37;40m%ls", L"囗");
+        put_glyph(L'囗', COLOR_DEFAULT, 2);
+    } else if (type == BLOCK_TYPE_GHOST) {
+        put_glyph(L'[', COLOR_DEFAULT, 1);
+        put_glyph(L']', COLOR_DEFAULT, 1);
     } else {
-        printf(ESC"%d;40;1m%ls", type % 6 + 31, L"田");
+        put_glyph(L'田', type % 6 + 1, 2);
     }
 }
 
 void clear_color(void) {
-    printf(ESC"0;37;40m");
+    draw_color = COLOR_DEFAULT;
+}
+
+void vprint_text(const char *format, va_list args) {
+    char buffer[256];
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    const char *p = buffer;
+    wchar_t wc;
+    size_t n;
+    while ((n = mbrtowc(&wc, p, strlen(p), &state)) != 0 &&
+           n != (size_t) -1 && n != (size_t) -2) {
+        p += n;
+        if (wc == L'\t') {
+            // 制表符只移动光标，不覆盖经过的字符
+            cursor_x = (Coordinate) ((cursor_x / 8 + 1) * 8);
+        } else {
+            int width = wcwidth(wc);
+            put_glyph(wc, draw_color, width == 2 ? 2 : 1);
+        }
+    }
 }
 
 void set_cursor_absolute_position(Coordinate x, Coordinate y) {
-    // POSIX控制台坐标从1开始
-    printf(ESC"%d;%dH", y + 1, x + 1);
+    cursor_x = x;
+    cursor_y = y;
 }
 
 
-Action get_action(uint32_t wait_time) {
-    usleep(1000 * wait_time);
+// 设置控制台文字属性，只输出和当前属性不同的部分
+// 默认色是不加粗的白色，方块的颜色都加粗，背景始终是黑色
+static void set_terminal_color(uint8_t color) {
+    if (color == terminal_color) {
+        return;
+    }
+    if (terminal_color < 0) {
+        if (color == COLOR_DEFAULT) {
+            output_printf(ESC"0;37;40m");
+        } else {
+            output_printf(ESC"0;%d;40;1m", color + 30);
+        }
+    } else if (color == COLOR_DEFAULT) {
+        output_printf(ESC"22;37m");
+    } else if (terminal_color == COLOR_DEFAULT) {
+        output_printf(ESC"%d;1m", color + 30);
+    } else {
+        output_printf(ESC"%dm", color + 30);
+    }
+    terminal_color = color;
+    output_stats.color_changes++;
+}
+
+// 生成相对移动序列，移动1格时省略数字
+static int format_relative_move(char *buffer, int n, char direction) {
+    return n == 1 ? sprintf(buffer, ESC"%c", direction) : sprintf(buffer, ESC"%d%c", n, direction);
+}
+
+// 将控制台光标移动到(x, y)，在可行的几种方式中选择输出最短的一种
+static void move_terminal_cursor(Coordinate x, Coordinate y) {
+    if (x == terminal_x && y == terminal_y) {
+        return;
+    }
+
+    // 绝对定位总是可行的，POSIX控制台坐标从1开始，列号为1时可以省略
+    char best[64];
+    int best_length = x == 0 ? sprintf(best, ESC"%dH", y + 1) : sprintf(best, ESC"%d;%dH", y + 1, x + 1);
+
+    if (terminal_x >= 0 && terminal_y >= 0) {
+        char candidate[64];
+        int length;
+        char vertical[16];
+        int vertical_length = 0;
+        if (y < terminal_y) {
+            vertical_length = format_relative_move(vertical, terminal_y - y, 'A');
+        } else if (y > terminal_y) {
+            vertical_length = format_relative_move(vertical, y - terminal_y, 'B');
+        }
+
+        // 相对移动
+        memcpy(candidate, vertical, vertical_length);
+        length = vertical_length;
+        if (x > terminal_x) {
+            length += format_relative_move(candidate + length, x - terminal_x, 'C');
+        } else if (x < terminal_x) {
+            length += format_relative_move(candidate + length, terminal_x - x, 'D');
+        }
+        if (length < best_length) {
+            memcpy(best, candidate, best_length = length);
+        }
+
+        // 回到行首再垂直移动，向下几行时直接换行可能更短
+        if (x == 0) {
+            candidate[0] = '\r';
+            length = 1;
+            if (y > terminal_y && y - terminal_y < vertical_length) {
+                memset(candidate + length, '\n', y - terminal_y);
+                length += y - terminal_y;
+            } else {
+                memcpy(candidate + length, vertical, vertical_length);
+                length += vertical_length;
+            }
+            if (length < best_length) {
+                memcpy(best, candidate, best_length = length);
+            }
+        }
+
+        // 同一行向右跳过几格时，把中间屏幕上已有的字符原样再输出一遍可能更短
+        if (y == terminal_y && x > terminal_x && x - terminal_x < best_length) {
+            const Cell *cell = cell_at(front_cells, terminal_x, y);
+            length = x - terminal_x;
+            for (int i = 0; i < length; i++) {
+                if (cell[i].glyph < L' ' || cell[i].glyph >= 0x80 ||
+                    (cell[i].glyph != L' ' && cell[i].color != terminal_color)) {
+                    length = best_length;
+                    break;
+                }
+                candidate[i] = (char) cell[i].glyph;
+            }
+            if (length < best_length) {
+                memcpy(best, candidate, best_length = length);
+            }
+        }
+    }
+
+    output_append(best, best_length);
+    terminal_x = x;
+    terminal_y = y;
+    output_stats.cursor_moves++;
+}
 
-    static int buffer[3];
-    size_t read_count = 0;
-    int ch;
-    while ((ch = getchar()) != EOF) {
-        if (read_count < sizeof(buffer) / sizeof(buffer[0])) {
-            buffer[read_count++] = ch;
+// 在(x, y)处输出单元格的颜色和字形
+static void output_cell(Coordinate x, Coordinate y, const Cell *cell, int width) {
+    move_terminal_cursor(x, y);
+    // 空格只显示背景色，而背景色总是一样的
+    if (cell->glyph != L' ' || terminal_color < 0) {
+        set_terminal_color(cell->color);
+    }
+    char buffer[MB_LEN_MAX];
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    size_t n = wcrtomb(buffer, cell->glyph, &state);
+    if (n == (size_t) -1) {
+        output_append("??", width);
+    } else {
+        output_append(buffer, n);
+    }
+    // 写到行尾后光标的状态因终端而异，当作未知
+    terminal_x += width;
+    if (terminal_x >= console_size.ws_col) {
+        terminal_x = -1;
+    }
+}
+
+void end_frame(void) {
+    for (Coordinate y = 0; y < console_size.ws_row; y++) {
+        Cell *back = cell_at(back_cells, 0, y);
+        Cell *front = cell_at(front_cells, 0, y);
+        for (Coordinate x = 0; x < console_size.ws_col; x++) {
+            int width = x + 1 < console_size.ws_col && back[x + 1].glyph == GLYPH_CONTINUATION ? 2 : 1;
+            if (back[x].glyph == GLYPH_CONTINUATION) {
+                continue;
+            }
+            if (!cell_equal(&back[x], &front[x]) || (width == 2 && !cell_equal(&back[x + 1], &front[x + 1]))) {
+                output_cell(x, y, &back[x], width);
+                memcpy(&front[x], &back[x], sizeof(Cell) * width);
+            }
+            x += width - 1;
         }
     }
+    output_flush();
+}
+
+void get_output_stats(OutputStats *stats) {
+    *stats = output_stats;
+}
+
+
+// 单字节按键对应的动作
+static Action decode_key(unsigned char ch) {
+    switch (ch) {
+        case 'P' - 64:
+            return ACTION_PAUSE;
+        case 'W' - 64:
+            return ACTION_SAVE;
+        case 'R' - 64:
+            return ACTION_LOAD;
+        case 'N' - 64:
+            return ACTION_NEW_GAME;
+        case 'U' - 64:
+            return ACTION_UNDO;
+        case 'E' - 64:
+            return ACTION_REDO;
+        case 'w':
+        case 'W':
+            return ACTION_ROTATE;
+        case 's':
+        case 'S':
+            return ACTION_DOWN;
+        case 'a':
+        case 'A':
+            return ACTION_LEFT;
+        case 'd':
+        case 'D':
+            return ACTION_RIGHT;
+        case ' ':
+        case '\n':
+            return ACTION_FAST_DOWN;
+        default:
+            return ACTION_UNRECOGNIZED;
+    }
+}
+
+// 方向键转义序列（ESC [ X或者ESC O X）最后一个字节对应的动作
+static Action decode_arrow_key(unsigned char final) {
+    switch (final) {
+        case 'A':
+            return ACTION_ROTATE;
+        case 'B':
+            return ACTION_DOWN;
+        case 'C':
+            return ACTION_RIGHT;
+        case 'D':
+            return ACTION_LEFT;
+        default:
+            return ACTION_UNRECOGNIZED;
+    }
+}
 
-    if (read_count == 0) {
-        return ACTION_EMPTY;
+// 生产者放入一个动作，队列满时丢弃
+static void push_action(Action action) {
+    size_t tail = atomic_load_explicit(&action_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&action_head, memory_order_acquire);
+    if (tail - head < ACTION_QUEUE_CAPACITY) {
+        action_queue[tail % ACTION_QUEUE_CAPACITY].action = action;
+        action_queue[tail % ACTION_QUEUE_CAPACITY].time = input_time;
+        atomic_store_explicit(&action_tail, tail + 1, memory_order_release);
+    }
+}
+
+// 消费者取出一个动作，队列空时返回false
+static bool pop_action(TimedAction *action) {
+    size_t head = atomic_load_explicit(&action_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&action_tail, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    *action = action_queue[head % ACTION_QUEUE_CAPACITY];
+    atomic_store_explicit(&action_head, head + 1, memory_order_release);
+    return true;
+}
+
+// 从输入字节的开头解码出一个按键，返回其长度，序列还不完整时返回0
+static size_t decode_input(const unsigned char *input, size_t length, Action *action) {
+    if (input[0] == 0x1B) {
+        if (length < 2) {
+            return 0;
+        }
+        if (input[1] != '[' && input[1] != 'O') {
+            // 单独的ESC键，后面的字节另行解码
+            *action = ACTION_UNRECOGNIZED;
+            return 1;
+        }
+        // 跳过参数和中间字节，直到结束字节
+        for (size_t i = 2; i < length; i++) {
+            if (input[i] >= 0x40 && input[i] <= 0x7E) {
+                *action = i == 2 ? decode_arrow_key(input[i]) : ACTION_UNRECOGNIZED;
+                return i + 1;
+            } else if (input[i] < 0x20 || input[i] > 0x3F) {
+                *action = ACTION_UNRECOGNIZED;
+                return i;
+            }
+        }
+        return 0;
+    } else if (input[0] >= 0xC0 && input[0] < 0xF8) {
+        // UTF-8多字节字符整体算作一个无法识别的按键
+        size_t n = input[0] >= 0xF0 ? 4 : input[0] >= 0xE0 ? 3 : 2;
+        if (length < n) {
+            return 0;
+        }
+        *action = ACTION_UNRECOGNIZED;
+        return n;
     } else {
-        switch (buffer[0]) {
-            case 'P' - 64:
-                return ACTION_PAUSE;
-            case 'W' - 64:
-                return ACTION_SAVE;
-            case 'R' - 64:
-                return ACTION_LOAD;
-            case 'N' - 64:
-                return ACTION_NEW_GAME;
-            case 'w':
-            case 'W':
-                return ACTION_ROTATE;
-            case 's':
-            case 'S':
-                return ACTION_DOWN;
-            case 'a':
-            case 'A':
-                return ACTION_LEFT;
-            case 'd':
-            case 'D':
-                return ACTION_RIGHT;
-            case ' ':
-            case '\n':
-                return ACTION_FAST_DOWN;
-            case 0x1B:
-                if (read_count >= 3 && buffer[1] == '[') {
-                    switch (buffer[2]) {
-                        case 'A':
-                            return ACTION_ROTATE;
-                        case 'B':
-                            return ACTION_DOWN;
-                        case 'C':
-                            return ACTION_RIGHT;
-                        case 'D':
-                            return ACTION_LEFT;
-                        default:
-                            return ACTION_UNRECOGNIZED;
-                    }
+        *action = decode_key(input[0]);
+        return 1;
+    }
+}
+
+// 解码已读入的全部完整按键，放入动作队列，不完整的部分留待下次
+static void decode_pending_input(void) {
+    size_t offset = 0;
+    while (offset < input_length) {
+        Action action;
+        size_t n = decode_input(input + offset, input_length - offset, &action);
+        if (n == 0) {
+            break;
+        }
+        push_action(action);
+        offset += n;
+    }
+    memmove(input, input + offset, input_length - offset);
+    input_length -= offset;
+    // 缓冲区被一个超长的序列填满，只能丢弃
+    if (input_length == sizeof(input)) {
+        push_action(ACTION_UNRECOGNIZED);
+        input_length = 0;
+    }
+}
+
+
+// 读入当前可读的全部输入并解码，返回false表示输入已经结束
+static bool read_input(void) {
+    ssize_t n = 1;
+    while (input_length < sizeof(input) &&
+           (n = read(STDIN_FILENO, input + input_length, sizeof(input) - input_length)) != 0) {
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        input_time = get_monotonic_time();
+        input_length += n;
+        decode_pending_input();
+    }
+    return n != 0;
+}
+
+// 等了一段时间也没有后续字节，那么不完整的序列其实是单独的按键，比如ESC
+static void flush_pending_input(void) {
+    while (input_length) {
+        push_action(ACTION_UNRECOGNIZED);
+        memmove(input, input + 1, --input_length);
+        decode_pending_input();
+    }
+}
+
+// 输入线程阻塞等待输入，解码后放入队列并唤醒游戏线程，直到被restore_console通知退出
+static void *input_thread_main(void *arg) {
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+    while (true) {
+        // 有不完整的序列时，只等待一小段时间后续字节
+        int ready = poll(fds, 2, input_length ? 50 : -1);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        } else if (fds[1].revents) {
+            break;
+        } else if (ready > 0 && fds[0].revents) {
+            if (!read_input()) {
+                atomic_store(&input_closed, true);
+                ssize_t ignored = write(wake_pipe[1], "", 1);
+                (void) ignored;
+                break;
+            }
+        } else if (ready == 0) {
+            flush_pending_input();
+        }
+        if (atomic_load_explicit(&action_tail, memory_order_relaxed) !=
+            atomic_load_explicit(&action_head, memory_order_relaxed)) {
+            // 管道满了说明游戏线程还没来得及处理之前的唤醒，不需要再写
+            ssize_t ignored = write(wake_pipe[1], "", 1);
+            (void) ignored;
+        }
+    }
+    return NULL;
+}
+
+bool start_input_thread(void) {
+    if (input_thread_running || pipe(wake_pipe) || pipe(stop_pipe)) {
+        return false;
+    }
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+    // thread_create屏蔽了SIGINT和SIGTERM，信号总是打断游戏线程的等待，不会被输入线程接收而错过
+    if (!thread_create(&input_thread, input_thread_main, NULL)) {
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        return false;
+    }
+    input_thread_running = true;
+    return true;
+}
+
+static void stop_input_thread(void) {
+    if (input_thread_running) {
+        ssize_t ignored = write(stop_pipe[1], "", 1);
+        (void) ignored;
+        thread_join(input_thread);
+        input_thread_running = false;
+    }
+}
+
+
+Action get_action(uint32_t wait_time) {
+    // 之前一次读到的多个按键，逐个返回，不需要等待
+    TimedAction action;
+    if (!pop_action(&action)) {
+        if (atomic_load(&input_closed)) {
+            // 输入结束后poll总是立即返回，不能再等待，否则游戏线程会一直空转
+        } else if (input_thread_running) {
+            // 等待输入线程唤醒
+            struct pollfd fd = {wake_pipe[0], POLLIN, 0};
+            if (poll(&fd, 1, (int) wait_time) > 0) {
+                char buffer[64];
+                while (read(wake_pipe[0], buffer, sizeof(buffer)) > 0);
+            }
+        } else {
+            // 等待标准输入可读或者超时，被信号打断也当作超时
+            struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+            if (poll(&fd, 1, (int) wait_time) > 0) {
+                if (!read_input()) {
+                    atomic_store(&input_closed, true);
                 }
-                return ACTION_UNRECOGNIZED;
-            default:
-                return ACTION_UNRECOGNIZED;
+            } else if (wait_time) {
+                flush_pending_input();
+            }
+        }
+        if (!pop_action(&action)) {
+            return atomic_load(&input_closed) ? ACTION_QUIT : ACTION_EMPTY;
+        }
+    }
+    last_action_time = action.time;
+    return action.action;
+}
+
+uint64_t get_action_time(void) {
+    return last_action_time;
+}
+
+
+uint64_t get_monotonic_time(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+const void *map_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    void *data = NULL;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        } else {
+            *size = st.st_size;
+        }
+    }
+    // 映射建立后就不再需要文件描述符了
+    close(fd);
+    return data;
+}
+
+void unmap_file(const void *data, size_t size) {
+    munmap((void *) data, size);
+}
+
+bool write_file_atomically(const char *path, const void *data, size_t size) {
+    size_t path_length = strlen(path);
+    char *temp_path = malloc(path_length + sizeof(".tmp"));
+    if (!temp_path) {
+        return false;
+    }
+    memcpy(temp_path, path, path_length);
+    memcpy(temp_path + path_length, ".tmp", sizeof(".tmp"));
+
+    bool successful = false;
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        const char *p = data;
+        size_t left = size;
+        while (left > 0) {
+            ssize_t n = write(fd, p, left);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                break;
+            }
+            p += n;
+            left -= n;
+        }
+        // 改名之前必须保证内容已经落盘，否则崩溃后可能得到一个改了名的空文件
+        successful = left == 0 && fsync(fd) == 0;
+        successful = close(fd) == 0 && successful;
+        successful = successful && rename(temp_path, path) == 0;
+        if (!successful) {
+            unlink(temp_path);
         }
     }
+    free(temp_path);
+    return successful;
 }
@@ -1,6 +1,10 @@
 #include "platform.h"
+#include "threads.h"
 
 #include <conio.h>
+#include <io.h>
+#include <stdlib.h>
+#include <string.h>
 #include <windows.h>
 
 
@@ -10,6 +14,23 @@
 static HANDLE handle;
 static CONSOLE_CURSOR_INFO old_cursor_info;
 static CONSOLE_SCREEN_BUFFER_INFO old_console_info;
+// 累计输出统计，字节数按printf的返回值计算
+static OutputStats output_stats;
+
+static void stop_input_thread(void);
+
+
+static void set_text_attribute(WORD attribute) {
+    SetConsoleTextAttribute(handle, attribute);
+    output_stats.color_changes++;
+}
+
+static void print_string(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprint_text(format, args);
+    va_end(args);
+}
 
 
 void prepare_console(void) {
@@ -27,6 +48,7 @@ void prepare_console(void) {
 
 
 void restore_console(void) {
+    stop_input_thread();
     // 恢复光标以及输出文本属性
     SetConsoleCursorInfo(handle, &old_cursor_info);
     SetConsoleTextAttribute(handle, old_console_info.wAttributes);
@@ -48,87 +70,286 @@ void clear_screen(void) {
 }
 
 
+void get_console_size(Coordinate *width, Coordinate *height) {
+    *width = (Coordinate) (old_console_info.srWindow.Right - old_console_info.srWindow.Left + 1);
+    *height = (Coordinate) (old_console_info.srWindow.Bottom - old_console_info.srWindow.Top + 1);
+}
+
+
 void print_block(BlockType type) {
     if (type == BLOCK_TYPE_NULL) {
-        SetConsoleTextAttribute(handle, DEFAULT_COLOR);
-        printf("  ");
+        set_text_attribute(DEFAULT_COLOR);
+        print_string("  ");
     } else if (type == BLOCK_TYPE_WALL) {
-        SetConsoleTextAttribute(handle, DEFAULT_COLOR);
-        printf("%ls", L"囗");
+        set_text_attribute(DEFAULT_COLOR);
+        print_string("%ls", L"囗");
+    } else if (type == BLOCK_TYPE_GHOST) {
+        set_text_attribute(DEFAULT_COLOR);
+        print_string("[]");
     } else {
-        SetConsoleTextAttribute(handle, (type % 6 + 1) | FOREGROUND_INTENSITY);
-        printf("%ls", L"田");
+        set_text_attribute((type % 6 + 1) | FOREGROUND_INTENSITY);
+        print_string("%ls", L"田");
     }
 }
 
 void clear_color(void) {
-    SetConsoleTextAttribute(handle, DEFAULT_COLOR);
+    set_text_attribute(DEFAULT_COLOR);
+}
+
+void vprint_text(const char *format, va_list args) {
+    int n = vprintf(format, args);
+    if (n > 0) {
+        output_stats.bytes += n;
+    }
 }
 
 void set_cursor_absolute_position(Coordinate x, Coordinate y) {
     // 窗口最左侧为X轴零点，但以光标初始高度为Y轴零点
     COORD coord = {x + old_console_info.srWindow.Left, y + old_console_info.dwCursorPosition.Y};
     SetConsoleCursorPosition(handle, coord);
+    output_stats.cursor_moves++;
 }
 
+void end_frame(void) {
+    // Windows控制台的绘制是即时生效的，只需要清空标准输出缓冲
+    fflush(stdout);
+}
 
-Action get_action(uint32_t wait_time) {
-    Sleep(wait_time);
+void get_output_stats(OutputStats *stats) {
+    *stats = output_stats;
+}
 
-    static int buffer[2];
-    size_t read_count = 0;
+
+// 读取并解码一个按键，方向键等功能键由前缀0xE0或0和第二个字节组成，两者总是同时可读
+static Action read_key(void) {
+    int ch = _getch();
+    switch (ch) {
+        case 'P' - 64:
+            return ACTION_PAUSE;
+        case 'W' - 64:
+            return ACTION_SAVE;
+        case 'R' - 64:
+            return ACTION_LOAD;
+        case 'N' - 64:
+            return ACTION_NEW_GAME;
+        case 'U' - 64:
+            return ACTION_UNDO;
+        case 'E' - 64:
+            return ACTION_REDO;
+        case 'w':
+        case 'W':
+            return ACTION_ROTATE;
+        case 's':
+        case 'S':
+            return ACTION_DOWN;
+        case 'a':
+        case 'A':
+            return ACTION_LEFT;
+        case 'd':
+        case 'D':
+            return ACTION_RIGHT;
+        case ' ':
+        case '\r':
+            return ACTION_FAST_DOWN;
+        case 0xE0:
+        case 0:
+            switch (_getch()) {
+                case 'H':
+                    return ACTION_ROTATE;
+                case 'P':
+                    return ACTION_DOWN;
+                case 'M':
+                    return ACTION_RIGHT;
+                case 'K':
+                    return ACTION_LEFT;
+                default:
+                    return ACTION_UNRECOGNIZED;
+            }
+        default:
+            return ACTION_UNRECOGNIZED;
+    }
+}
+
+// 已解码但还没有返回的动作及其到达时间，连续的多个按键逐个返回，不会丢失
+// 有输入线程时由它读取按键写入队列，与get_action之间用queue_lock保护，写入后设置queue_event唤醒get_action
+#define ACTION_QUEUE_CAPACITY   64
+static Action action_queue[ACTION_QUEUE_CAPACITY];
+static uint64_t action_times[ACTION_QUEUE_CAPACITY];
+static size_t action_head;
+static size_t action_count;
+static Mutex queue_lock = MUTEX_INITIALIZER;
+static uint64_t last_action_time;
+
+static bool input_thread_running;
+static Thread input_thread;
+static HANDLE queue_event;
+static HANDLE stop_event;
+
+
+// 读取所有已经可读的按键放入队列，队列满时剩下的按键留在控制台缓冲中，返回是否读到了按键
+static bool read_keys(void) {
+    uint64_t now = get_monotonic_time();
+    bool read = false;
     while (_kbhit()) {
-        int ch = _getch();
-        if (read_count < sizeof(buffer) / sizeof(buffer[0])) {
-            buffer[read_count++] = ch;
+        // 只有这一个线程写入，检查之后队列不会变满
+        mutex_lock(&queue_lock);
+        bool full = action_count == ACTION_QUEUE_CAPACITY;
+        mutex_unlock(&queue_lock);
+        if (full) {
+            break;
+        }
+        Action action = read_key();
+        mutex_lock(&queue_lock);
+        size_t tail = (action_head + action_count++) % ACTION_QUEUE_CAPACITY;
+        action_queue[tail] = action;
+        action_times[tail] = now;
+        mutex_unlock(&queue_lock);
+        read = true;
+    }
+    return read;
+}
+
+// 输入线程轮询按键，读到后唤醒游戏线程，直到被restore_console通知退出
+// 控制台输入句柄在有鼠标、焦点等事件时也会被触发，所以仍用短间隔轮询，但游戏线程不必再轮询
+static THREAD_FUNCTION(input_thread_main, argument) {
+    (void) argument;
+    while (WaitForSingleObject(stop_event, 1) == WAIT_TIMEOUT) {
+        if (read_keys()) {
+            SetEvent(queue_event);
         }
     }
+    THREAD_RETURN;
+}
 
-    if (read_count == 0) {
-        return ACTION_EMPTY;
-    } else {
-        switch (buffer[0]) {
-            case 'P' - 64:
-                return ACTION_PAUSE;
-            case 'W' - 64:
-                return ACTION_SAVE;
-            case 'R' - 64:
-                return ACTION_LOAD;
-            case 'N' - 64:
-                return ACTION_NEW_GAME;
-            case 'w':
-            case 'W':
-                return ACTION_ROTATE;
-            case 's':
-            case 'S':
-                return ACTION_DOWN;
-            case 'a':
-            case 'A':
-                return ACTION_LEFT;
-            case 'd':
-            case 'D':
-                return ACTION_RIGHT;
-            case ' ':
-            case '\r':
-                return ACTION_FAST_DOWN;
-            case 0xE0:
-                if (read_count >= 2) {
-                    switch (buffer[1]) {
-                        case 'H':
-                            return ACTION_ROTATE;
-                        case 'P':
-                            return ACTION_DOWN;
-                        case 'M':
-                            return ACTION_RIGHT;
-                        case 'K':
-                            return ACTION_LEFT;
-                        default:
-                            return ACTION_UNRECOGNIZED;
-                    }
+bool start_input_thread(void) {
+    if (input_thread_running) {
+        return false;
+    }
+    // 自动重置：每次唤醒一次get_action
+    queue_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (queue_event && stop_event && thread_create(&input_thread, input_thread_main, NULL)) {
+        input_thread_running = true;
+        return true;
+    }
+    if (queue_event) {
+        CloseHandle(queue_event);
+    }
+    if (stop_event) {
+        CloseHandle(stop_event);
+    }
+    return false;
+}
+
+static void stop_input_thread(void) {
+    if (input_thread_running) {
+        SetEvent(stop_event);
+        thread_join(input_thread);
+        CloseHandle(queue_event);
+        CloseHandle(stop_event);
+        input_thread_running = false;
+    }
+}
+
+
+Action get_action(uint32_t wait_time) {
+    mutex_lock(&queue_lock);
+    bool empty = action_count == 0;
+    mutex_unlock(&queue_lock);
+    if (empty) {
+        if (input_thread_running) {
+            // 等待输入线程唤醒
+            WaitForSingleObject(queue_event, wait_time);
+        } else {
+            ULONGLONG deadline = GetTickCount64() + wait_time;
+            while (!_kbhit()) {
+                if (GetTickCount64() >= deadline) {
+                    return ACTION_EMPTY;
                 }
-                return ACTION_UNRECOGNIZED;
-            default:
-                return ACTION_UNRECOGNIZED;
+                Sleep(1);
+            }
+            read_keys();
+        }
+    }
+
+    mutex_lock(&queue_lock);
+    Action action = ACTION_EMPTY;
+    if (action_count) {
+        last_action_time = action_times[action_head];
+        action = action_queue[action_head];
+        action_head = (action_head + 1) % ACTION_QUEUE_CAPACITY;
+        action_count--;
+    }
+    mutex_unlock(&queue_lock);
+    return action;
+}
+
+
+uint64_t get_action_time(void) {
+    return last_action_time;
+}
+
+
+uint64_t get_monotonic_time(void) {
+    static LARGE_INTEGER frequency;
+    if (!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (uint64_t) (counter.QuadPart / frequency.QuadPart * 1000000000 +
+                       counter.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart);
+}
+
+
+const void *map_file(const char *path, size_t *size) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    const void *data = NULL;
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            // 视图会保持映射对象有效，所以两个句柄都可以先关闭
+            if ((data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0))) {
+                *size = (size_t) file_size.QuadPart;
+            }
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    return data;
+}
+
+void unmap_file(const void *data, size_t size) {
+    (void) size;
+    UnmapViewOfFile(data);
+}
+
+bool write_file_atomically(const char *path, const void *data, size_t size) {
+    size_t path_length = strlen(path);
+    char *temp_path = malloc(path_length + sizeof(".tmp"));
+    if (!temp_path) {
+        return false;
+    }
+    memcpy(temp_path, path, path_length);
+    memcpy(temp_path + path_length, ".tmp", sizeof(".tmp"));
+
+    bool successful = false;
+    FILE *fp = fopen(temp_path, "wb");
+    if (fp) {
+        // 改名之前必须保证内容已经落盘
+        successful = (size == 0 || fwrite(data, size, 1, fp) == 1) && fflush(fp) == 0 && _commit(_fileno(fp)) == 0;
+        successful = fclose(fp) == 0 && successful;
+        // rename不能覆盖已有文件，MoveFileEx可以，并且等到改名也落盘了才返回
+        successful = successful && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+        if (!successful) {
+            DeleteFileA(temp_path);
         }
     }
+    free(temp_path);
+    return successful;
 }
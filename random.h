@@ -0,0 +1,51 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+// 伪随机数发生器PCG32（XSH RR变体），状态完全保存在Random结构体中，没有全局状态
+// 每局游戏、每个线程各用各的，互不干扰；只用整数运算，同一种子在任何平台上都产生同样的序列
+
+#include <inttypes.h>
+
+
+typedef struct {
+    uint64_t state;
+    uint64_t increment;
+} Random;
+
+
+// 产生下一个32位随机数
+static inline uint32_t random_next(Random *random) {
+    uint64_t state = random->state;
+    random->state = state * 6364136223846793005u + random->increment;
+    uint32_t xorshifted = (uint32_t) (((state >> 18u) ^ state) >> 27u);
+    uint32_t rotation = (uint32_t) (state >> 59u);
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+}
+
+// 用种子初始化，种子的高低位都会影响序列
+static inline void random_seed(Random *random, uint64_t seed) {
+    random->state = 0;
+    random->increment = (seed << 1u) | 1u;
+    random_next(random);
+    random->state += seed ^ 0x853c49e6748fea9bu;
+    random_next(random);
+}
+
+// 产生[0, bound)之间均匀分布的随机数，拒绝掉不能整除的尾部以避免取模带来的偏差
+static inline uint32_t random_below(Random *random, uint32_t bound) {
+    uint32_t threshold = -bound % bound;
+    for (;;) {
+        uint32_t r = random_next(random);
+        if (r >= threshold) {
+            return r % bound;
+        }
+    }
+}
+
+// 产生一个64位随机数，例如作为下一局游戏的种子
+static inline uint64_t random_next64(Random *random) {
+    uint64_t high = random_next(random);
+    return high << 32u | random_next(random);
+}
+
+#endif
@@ -0,0 +1,286 @@
+#include "replay.h"
+#include "history.h"
+#include "threads.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define REPLAY_MAGIC            "CTRP"
+#define REPLAY_VERSION          1
+#define REPLAY_HEADER_SIZE      18
+
+// 每个写入缓冲的大小，一条记录最多10个字节，满了交给写入线程写入文件
+#define REPLAY_BUFFER_SIZE      65536
+#define MAX_VARINT_SIZE         10
+
+// 记录中动作所占的位数
+#define ACTION_BITS             4
+
+
+// 两个缓冲轮流使用：游戏线程写满一个就交给写入线程，接着写另一个，写文件不会阻塞游戏线程
+struct ReplayWriter {
+    FILE *file;
+    // 上一条记录的时间，纳秒，按整毫秒推进，这样舍入误差不会累积
+    uint64_t last_time;
+    // 游戏线程正在写的缓冲及其已用长度，只由游戏线程使用
+    int current;
+    size_t length;
+    Thread thread;
+
+    // 以下由mutex保护，condition在交出缓冲、写完缓冲以及要求结束时都会广播
+    Mutex mutex;
+    Condition condition;
+    // 交给写入线程还没写完的缓冲，pending_length为0表示没有
+    const uint8_t *pending;
+    size_t pending_length;
+    bool stopping;
+    bool failed;
+
+    uint8_t buffers[2][REPLAY_BUFFER_SIZE];
+};
+
+
+static void put_little_endian(uint8_t *p, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+static uint64_t get_little_endian(const uint8_t *p, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t) p[i] << (8 * i);
+    }
+    return value;
+}
+
+
+static THREAD_FUNCTION(replay_writer_main, argument) {
+    ReplayWriter *writer = argument;
+    name_trace_thread("replay");
+    mutex_lock(&writer->mutex);
+    while (true) {
+        while (!writer->pending_length && !writer->stopping) {
+            condition_wait(&writer->condition, &writer->mutex);
+        }
+        // 要求结束时也要先把交来的缓冲写完
+        if (!writer->pending_length) {
+            break;
+        }
+        const uint8_t *data = writer->pending;
+        size_t length = writer->pending_length;
+        mutex_unlock(&writer->mutex);
+
+        bool successful;
+        TRACE_SPAN("write_replay") {
+            successful = fwrite(data, length, 1, writer->file) == 1;
+        }
+
+        mutex_lock(&writer->mutex);
+        writer->failed |= !successful;
+        writer->pending_length = 0;
+        condition_broadcast(&writer->condition);
+    }
+    mutex_unlock(&writer->mutex);
+    THREAD_RETURN;
+}
+
+// 把当前缓冲交给写入线程，换用另一个；只有写入线程还没写完上一个缓冲时才需要等待
+static void hand_buffer(ReplayWriter *writer) {
+    if (!writer->length) {
+        return;
+    }
+    mutex_lock(&writer->mutex);
+    while (writer->pending_length) {
+        condition_wait(&writer->condition, &writer->mutex);
+    }
+    writer->pending = writer->buffers[writer->current];
+    writer->pending_length = writer->length;
+    condition_broadcast(&writer->condition);
+    mutex_unlock(&writer->mutex);
+    writer->current = 1 - writer->current;
+    writer->length = 0;
+}
+
+
+ReplayWriter *create_replay(const char *path, GameInfo *game, uint64_t time) {
+    ReplayWriter *writer = malloc(sizeof(ReplayWriter));
+    if (!writer) {
+        return NULL;
+    }
+    if (!(writer->file = fopen(path, "wb"))) {
+        free(writer);
+        return NULL;
+    }
+    // 缓冲由自己管理，标准库就不用再缓冲一遍了
+    setvbuf(writer->file, NULL, _IONBF, 0);
+    writer->last_time = time;
+    writer->current = 0;
+    writer->pending_length = 0;
+    writer->stopping = false;
+    writer->failed = false;
+    mutex_init(&writer->mutex);
+    condition_init(&writer->condition);
+    if (!thread_create(&writer->thread, replay_writer_main, writer)) {
+        condition_destroy(&writer->condition);
+        mutex_destroy(&writer->mutex);
+        fclose(writer->file);
+        free(writer);
+        return NULL;
+    }
+
+    uint8_t *header = writer->buffers[0];
+    memcpy(header, REPLAY_MAGIC, 4);
+    header[4] = REPLAY_VERSION;
+    header[5] = game->randomizer;
+    put_little_endian(header + 6, (uint16_t) game->width, 2);
+    put_little_endian(header + 8, (uint16_t) game->height, 2);
+    put_little_endian(header + 10, game->seed, 8);
+    writer->length = REPLAY_HEADER_SIZE;
+    return writer;
+}
+
+
+void record_action(ReplayWriter *writer, Action action, uint64_t time) {
+    uint64_t delta = time > writer->last_time ? (time - writer->last_time) / 1000000 : 0;
+    writer->last_time += delta * 1000000;
+    if (writer->length + MAX_VARINT_SIZE > REPLAY_BUFFER_SIZE) {
+        hand_buffer(writer);
+    }
+    // 时间差大到放不下时就截断，回放并不依赖它
+    uint64_t value = (delta < (UINT64_MAX >> ACTION_BITS) ? delta : UINT64_MAX >> ACTION_BITS) << ACTION_BITS
+                     | (uint64_t) action;
+    uint8_t *buffer = writer->buffers[writer->current];
+    do {
+        buffer[writer->length++] = (uint8_t) (value & 0x7F) | (value >= 0x80 ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+}
+
+
+bool close_replay(ReplayWriter *writer) {
+    hand_buffer(writer);
+    mutex_lock(&writer->mutex);
+    writer->stopping = true;
+    condition_broadcast(&writer->condition);
+    mutex_unlock(&writer->mutex);
+    thread_join(writer->thread);
+    condition_destroy(&writer->condition);
+    mutex_destroy(&writer->mutex);
+    bool successful = !writer->failed && fclose(writer->file) == 0;
+    free(writer);
+    return successful;
+}
+
+
+bool open_replay(ReplayReader *reader, const char *path) {
+    memset(reader, 0, sizeof(ReplayReader));
+    if (!(reader->data = map_file(path, &reader->size))) {
+        return false;
+    }
+    const uint8_t *header = reader->data;
+    if (reader->size < REPLAY_HEADER_SIZE || memcmp(header, REPLAY_MAGIC, 4) != 0 ||
+        header[4] != REPLAY_VERSION || header[5] > RANDOMIZER_BAG) {
+        close_replay_reader(reader);
+        return false;
+    }
+    reader->randomizer = header[5];
+    reader->width = (Coordinate) get_little_endian(header + 6, 2);
+    reader->height = (Coordinate) get_little_endian(header + 8, 2);
+    reader->seed = get_little_endian(header + 10, 8);
+    reader->position = REPLAY_HEADER_SIZE;
+    return true;
+}
+
+
+GameInfo *create_replay_game(ReplayReader *reader) {
+    if (reader->width < MAX_TETRIMINO_LENGTH || reader->width > MAX_WELL_WIDTH ||
+        reader->height < MAX_TETRIMINO_LENGTH || reader->height > MAX_WELL_HEIGHT) {
+        return NULL;
+    }
+    return create_new_game(reader->width, reader->height, reader->seed, reader->randomizer);
+}
+
+
+bool next_replay_action(ReplayReader *reader, Action *action, uint32_t *delta) {
+    uint64_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        if (reader->position >= reader->size || shift >= 64) {
+            return false;
+        }
+        uint8_t byte = reader->data[reader->position++];
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    uint64_t value_delta = value >> ACTION_BITS;
+    *action = (Action) (value & ((1 << ACTION_BITS) - 1));
+    *delta = value_delta < UINT32_MAX ? (uint32_t) value_delta : UINT32_MAX;
+    // 录像中只有改变游戏进程的动作
+    return (*action >= ACTION_LEFT && *action <= ACTION_ROTATE) || *action == ACTION_NEW_GAME ||
+           *action == ACTION_UNDO || *action == ACTION_REDO;
+}
+
+
+void close_replay_reader(ReplayReader *reader) {
+    if (reader->data) {
+        unmap_file(reader->data, reader->size);
+        reader->data = NULL;
+    }
+}
+
+
+void play_replay(ReplayReader *reader, ReplayResult *result) {
+    memset(result, 0, sizeof(ReplayResult));
+    GameInfo *game = create_replay_game(reader);
+    // 与录制时的容量相同，录像中的撤销和重做都能同样成功
+    History *history = create_history(DEFAULT_HISTORY_CAPACITY);
+    if (!game || !history) {
+        free(game);
+        if (history) {
+            destroy_history(history);
+        }
+        return;
+    }
+    result->games = 1;
+    Action action;
+    uint32_t delta;
+    while (next_replay_action(reader, &action, &delta)) {
+        // 游戏结束后只能开始新游戏，录制时也不会有别的动作
+        if (action != ACTION_NEW_GAME && is_game_over(game)) {
+            result->desynced = true;
+            break;
+        }
+        result->actions++;
+        result->duration += delta;
+        if (action == ACTION_NEW_GAME) {
+            result->pieces += game->count;
+            result->scores += game->scores;
+            GameInfo *next = create_next_game(game);
+            free(game);
+            if (!(game = next)) {
+                destroy_history(history);
+                return;
+            }
+            clear_history(history);
+            result->games++;
+        } else if (action == ACTION_UNDO) {
+            // 撤销了的消行不算
+            int lines = undo_piece(history, game);
+            result->lines -= lines > 0 ? lines : 0;
+        } else if (action == ACTION_REDO) {
+            int lines = redo_piece(history, game);
+            result->lines += lines > 0 ? lines : 0;
+        } else {
+            StepEvents events = step_game_recorded(history, game, action);
+            result->lines += events.full_count;
+        }
+    }
+    result->pieces += game->count;
+    result->scores += game->scores;
+    destroy_history(history);
+    free(game);
+}
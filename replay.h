@@ -0,0 +1,69 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+// 游戏录像：记录种子、游戏池大小以及交给step_game的每一个动作，回放时按同样的顺序执行即可重现整局游戏
+//
+// 文件格式，多字节整数均为小端序：
+//   4字节 "CTRP"
+//   1字节 版本号
+//   1字节 randomizer
+//   2字节 宽度，2字节 高度
+//   8字节 种子
+// 之后每个动作一条记录，为一个varint（每字节低7位为数据，最高位表示后面还有字节）
+// 其值为 (距上一条记录的毫秒数 << 4) | 动作，绝大部分记录只占1到2个字节
+// 撤销和重做只记录成功了的，回放时按同样容量的历史执行，结果相同
+
+#include "tetris.h"
+
+
+typedef struct ReplayWriter ReplayWriter;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t position;
+    uint64_t seed;
+    Randomizer randomizer;
+    Coordinate width;
+    Coordinate height;
+} ReplayReader;
+
+// 回放的统计结果
+typedef struct {
+    uint64_t actions;
+    uint32_t games;
+    uint32_t pieces;
+    uint32_t lines;
+    uint32_t scores;
+    // 录像中记录的游戏时长，毫秒
+    uint64_t duration;
+    // 某一局结束后录像中接着的不是开始新游戏，回放在此停止
+    bool desynced;
+} ReplayResult;
+
+
+// 开始录制game这一局，启动写入线程并写入文件头，time是开始时间，与get_monotonic_time同一时钟，失败返回NULL
+ReplayWriter *create_replay(const char *path, GameInfo *game, uint64_t time);
+
+// 记录一个动作，先写到缓冲中，缓冲满了交给后台的写入线程写入文件，游戏线程不等待写文件
+void record_action(ReplayWriter *writer, Action action, uint64_t time);
+
+// 写入剩下的缓冲，等写入线程结束后关闭，返回是否全部写入成功
+bool close_replay(ReplayWriter *writer);
+
+
+// 打开录像文件并检查文件头，失败返回false
+bool open_replay(ReplayReader *reader, const char *path);
+
+// 按照文件头创建录像开始时的那一局游戏
+GameInfo *create_replay_game(ReplayReader *reader);
+
+// 读取下一个动作以及它距上一个动作的毫秒数，录像结束或者数据损坏返回false
+bool next_replay_action(ReplayReader *reader, Action *action, uint32_t *delta);
+
+void close_replay_reader(ReplayReader *reader);
+
+// 不显示地以最快速度回放整个录像，包括其中按ctrl+N开始的后续各局
+void play_replay(ReplayReader *reader, ReplayResult *result);
+
+#endif
@@ -0,0 +1,200 @@
+#include "rowscan.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define ROW_SCAN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC和Clang需要标明使用了哪些指令集的函数，其余代码仍按默认的指令集编译；MSVC可以直接使用各种内建函数
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2             __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+
+typedef enum {
+    ROW_MIXED,      // 既有方块也有空格
+    ROW_FULL,
+    ROW_EMPTY
+} RowClass;
+
+// 判断一行是满行、空行还是两者都不是，words至少为2，最后一个字中只有last_mask中的位属于游戏池
+typedef RowClass (*RowKernel)(const RowBits *row, size_t words, RowBits last_mask);
+
+typedef struct {
+    const char *name;
+    RowKernel classify;
+    bool (*supported)(void);
+} KernelInfo;
+
+
+// all是最后一个字之前各字的与，any是它们的或，结合最后一个字得出结论
+static RowClass finish_row(RowBits all, RowBits any, RowBits last, RowBits last_mask) {
+    if (!~all && last == last_mask) {
+        return ROW_FULL;
+    }
+    return !any && !last ? ROW_EMPTY : ROW_MIXED;
+}
+
+
+static RowClass classify_row_scalar(const RowBits *row, size_t words, RowBits last_mask) {
+    RowBits all = ~(RowBits) 0, any = 0;
+    for (size_t i = 0; i + 1 < words; i++) {
+        all &= row[i];
+        any |= row[i];
+        if (~all && any) {
+            return ROW_MIXED;
+        }
+    }
+    return finish_row(all, any, row[words - 1], last_mask);
+}
+
+static bool always_supported(void) {
+    return true;
+}
+
+
+#ifdef ROW_SCAN_X86
+
+// 每次4个字
+TARGET_AVX2 static RowClass classify_row_avx2(const RowBits *row, size_t words, RowBits last_mask) {
+    size_t count = words - 1;
+    __m256i ones = _mm256_set1_epi8(-1);
+    __m256i all = ones, any = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (row + i));
+        all = _mm256_and_si256(all, v);
+        any = _mm256_or_si256(any, v);
+        if (!_mm256_testc_si256(all, ones) && !_mm256_testz_si256(any, any)) {
+            return ROW_MIXED;
+        }
+    }
+    RowBits all_bits = _mm256_testc_si256(all, ones) ? ~(RowBits) 0 : 0;
+    RowBits any_bits = _mm256_testz_si256(any, any) ? 0 : 1;
+    for (; i < count; i++) {
+        all_bits &= row[i];
+        any_bits |= row[i];
+    }
+    return finish_row(all_bits, any_bits, row[count], last_mask);
+}
+
+
+#ifdef _MSC_VER
+
+// 除了处理器支持，操作系统还要在切换线程时保存YMM寄存器
+static bool avx2_supported(void) {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    if (!((info[2] >> 27) & 1) || !((info[2] >> 28) & 1) || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 5) & 1;
+}
+
+#else
+
+static bool avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+#endif
+
+
+// 按优先顺序排列，自动选择时取第一个支持的
+static const KernelInfo kernels[] = {
+#ifdef ROW_SCAN_X86
+        {"avx2", classify_row_avx2, avx2_supported},
+#endif
+        {"scalar", classify_row_scalar, always_supported},
+};
+
+// 默认是最后的逐字实现，init_row_kernels在启动线程之前换成处理器支持的最快的一个，之后只读
+static const KernelInfo *kernel = &kernels[sizeof(kernels) / sizeof(kernels[0]) - 1];
+
+
+void init_row_kernels(void) {
+    select_row_kernel(NULL);
+}
+
+
+bool select_row_kernel(const char *name) {
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if ((!name || strcmp(name, kernels[i].name) == 0) && kernels[i].supported()) {
+            kernel = &kernels[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char *row_kernel_name(void) {
+    return kernel->name;
+}
+
+
+void scan_rows(GameInfo *game, Coordinate bottom, Coordinate full_top, bool find_top, RowScan *scan) {
+    size_t words = game->row_words;
+    RowBits last_mask = row_word_mask(game->width, words - 1);
+    Coordinate rows = well_row_count(game->height);
+    scan->full_count = 0;
+    Coordinate y;
+    for (y = bottom; y < rows; y++) {
+        if (y >= full_top && !find_top && !scan->full_count) {
+            break;
+        }
+        const RowBits *row = well_row(game, y);
+        RowClass row_class = words == 1 ? finish_row(~(RowBits) 0, 0, row[0], last_mask)
+                                        : kernel->classify(row, words, last_mask);
+        if (row_class == ROW_EMPTY) {
+            break;
+        }
+        if (row_class == ROW_FULL && y < full_top && scan->full_count < MAX_TETRIMINO_LENGTH) {
+            scan->full_rows[scan->full_count++] = y;
+        }
+    }
+    scan->top = y;
+}
+
+
+// 把[from, to)这几行的方块和位图整段移动到dest开始的各行，可以重叠
+static void move_rows(GameInfo *game, Coordinate dest, Coordinate from, Coordinate to) {
+    if (to > from) {
+        memmove(well_block(game, 0, dest), well_block(game, 0, from), sizeof(BlockType) * game->width * (to - from));
+        memmove(well_row(game, dest), well_row(game, from), sizeof(RowBits) * game->row_words * (to - from));
+    }
+}
+
+
+void compact_rows(GameInfo *game, const Coordinate *cleared, int count, Coordinate top) {
+    // 第i个满行与下一个满行（或者top）之间的各行下移i + 1行
+    for (int i = 0; i < count; i++) {
+        Coordinate from = cleared[i] + 1;
+        move_rows(game, from - (i + 1), from, i + 1 < count ? cleared[i + 1] : top);
+    }
+    memset(well_block(game, 0, top - count), BLOCK_TYPE_NULL, sizeof(BlockType) * game->width * count);
+    memset(well_row(game, top - count), 0, sizeof(RowBits) * game->row_words * count);
+}
+
+
+void expand_rows(GameInfo *game, const Coordinate *cleared, int count, Coordinate top) {
+    // 与compact_rows相反，从最上面一段开始上移，第i个空出的行与下一个（或者top + count）之间的各行来自下方i + 1行处
+    for (int i = count - 1; i >= 0; i--) {
+        Coordinate from = cleared[i] - i;
+        move_rows(game, cleared[i] + 1, from, i + 1 < count ? cleared[i + 1] - (i + 1) : top);
+    }
+}
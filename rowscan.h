@@ -0,0 +1,44 @@
+#ifndef ROWSCAN_H
+#define ROWSCAN_H
+
+// 行扫描与压缩：消行时一趟扫描找出骨板所在各行中的满行，以及其上第一个空行，
+// 再一趟把满行之间剩下的各段整段下移，每段的方块和位图各只需一次memmove，与行数无关
+// 宽游戏池的一行有很多个字，逐行判断满行和空行的内核按处理器支持的指令集在运行时选用AVX2或者逐字的实现，
+// 内核同时累计全部字的与和或，一旦既不可能满也不可能空就提前结束，大多数行只看第一组字；一行只有一个字时不调用内核
+
+#include "tetris.h"
+
+
+// 一趟扫描的结果
+typedef struct {
+    // 满行的个数以及行号，从下往上
+    int full_count;
+    Coordinate full_rows[MAX_TETRIMINO_LENGTH];
+    // 扫描停止的那一行，通常是找到的第一个空行，一直没有空行时为总行数
+    Coordinate top;
+} RowScan;
+
+
+// 从第bottom行往上扫描，[bottom, full_top)中的满行依次记入scan，最多MAX_TETRIMINO_LENGTH个，遇到空行即停止
+// 有满行或者find_top为true时一直扫描到第一个空行，否则最多扫描到full_top，scan->top都是停止的那一行
+void scan_rows(GameInfo *game, Coordinate bottom, Coordinate full_top, bool find_top, RowScan *scan);
+
+// 移除从下往上的count个行cleared，它们与top之间的各行整段下移，顶部空出的count行清空
+// top是cleared之上的第一个空行，其上都是空的，不需要移动
+void compact_rows(GameInfo *game, const Coordinate *cleared, int count, Coordinate top);
+
+// compact_rows的逆操作：top之下的各行整段上移，在cleared处重新空出count行，其内容由调用者填入
+// cleared是插回之后的行号，top是插回之前第一个空行
+void expand_rows(GameInfo *game, const Coordinate *cleared, int count, Coordinate top);
+
+// 选出处理器支持的最快的内核，程序开始时在启动任何线程之前调用一次，之前使用逐字的实现
+void init_row_kernels(void);
+
+// 当前使用的逐行判断内核的名字，"avx2"或者"scalar"
+const char *row_kernel_name(void);
+
+// 指定使用的内核，用于比较各个内核的速度，当前处理器不支持或者没有这个名字时返回false，NULL恢复为自动选择
+// 与init_row_kernels一样，不能在其他线程正在扫描时调用
+bool select_row_kernel(const char *name);
+
+#endif
@@ -0,0 +1,225 @@
+#include "save.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define SAVE_MAGIC              "CTSV"
+#define SAVE_VERSION            1
+
+// 除了方块以外的固定部分，以及最后的校验和
+#define SAVE_HEADER_SIZE        (4 + 1 + 2 + 2 + 8 + 8 + 8 + 1 + 1 + TETRIMINO_SHAPE_COUNT + 4 + 4 + 6 \
+                                 + 2 * (FORECAST_COUNT + 1))
+#define SAVE_CHECKSUM_SIZE      4
+
+// 每格方块所占的位数
+#define CELL_BITS               3
+
+// 按顺序写入/读取各个字段
+typedef struct {
+    uint8_t *p;
+} Writer;
+
+typedef struct {
+    const uint8_t *p;
+} Reader;
+
+static void write_integer(Writer *writer, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        *writer->p++ = (uint8_t) (value >> (8 * i));
+    }
+}
+
+static uint64_t read_integer(Reader *reader, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t) *reader->p++ << (8 * i);
+    }
+    return value;
+}
+
+
+// 标准的CRC-32（与zlib相同），逐位计算，存档很小，不需要查表
+static uint32_t crc32(const uint8_t *data, size_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+
+static size_t cells_size(Coordinate width, Coordinate height) {
+    return ((size_t) width * height * CELL_BITS + 7) / 8;
+}
+
+size_t saved_game_size(GameInfo *game) {
+    return SAVE_HEADER_SIZE + cells_size(game->width, game->height) + SAVE_CHECKSUM_SIZE;
+}
+
+
+size_t serialize_game(GameInfo *game, uint8_t *buffer) {
+    Writer writer = {buffer};
+    memcpy(writer.p, SAVE_MAGIC, 4);
+    writer.p += 4;
+    write_integer(&writer, SAVE_VERSION, 1);
+    write_integer(&writer, (uint16_t) game->width, 2);
+    write_integer(&writer, (uint16_t) game->height, 2);
+    write_integer(&writer, game->seed, 8);
+    write_integer(&writer, game->random.state, 8);
+    write_integer(&writer, game->random.increment, 8);
+    write_integer(&writer, game->randomizer, 1);
+    write_integer(&writer, game->bag_count, 1);
+    for (int i = 0; i < TETRIMINO_SHAPE_COUNT; i++) {
+        write_integer(&writer, game->bag[i], 1);
+    }
+    write_integer(&writer, game->scores, 4);
+    write_integer(&writer, game->count, 4);
+    write_integer(&writer, game->current.type, 1);
+    write_integer(&writer, game->current.rotation, 1);
+    write_integer(&writer, (uint16_t) game->current.x, 2);
+    write_integer(&writer, (uint16_t) game->current.y, 2);
+    for (int i = 0; i <= FORECAST_COUNT; i++) {
+        write_integer(&writer, game->forecasts[i].type, 1);
+        write_integer(&writer, game->forecasts[i].rotation, 1);
+    }
+
+    // 方块逐个拼接成位流
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (Coordinate y = 0; y < game->height; y++) {
+        for (Coordinate x = 0; x < game->width; x++) {
+            BlockType type = *well_block(game, x, y);
+            uint32_t cell = type == BLOCK_TYPE_NULL ? 0 : type - BLOCK_TYPE_NORMAL_MIN + 1;
+            bits |= cell << bit_count;
+            if ((bit_count += CELL_BITS) >= 8) {
+                *writer.p++ = (uint8_t) bits;
+                bits >>= 8;
+                bit_count -= 8;
+            }
+        }
+    }
+    if (bit_count > 0) {
+        *writer.p++ = (uint8_t) bits;
+    }
+
+    write_integer(&writer, crc32(buffer, writer.p - buffer), 4);
+    return writer.p - buffer;
+}
+
+
+static bool valid_tetrimino_type(BlockType type) {
+    return type >= BLOCK_TYPE_NORMAL_MIN && type < BLOCK_TYPE_NORMAL_MIN + TETRIMINO_SHAPE_COUNT;
+}
+
+
+GameInfo *deserialize_game(const uint8_t *data, size_t size) {
+    // 先检查文件头和大小，大小由宽高算出，不相信其他任何数据
+    if (size < SAVE_HEADER_SIZE + SAVE_CHECKSUM_SIZE || memcmp(data, SAVE_MAGIC, 4) != 0) {
+        return NULL;
+    }
+    Reader reader = {data + 4};
+    uint64_t version = read_integer(&reader, 1);
+    Coordinate width = (Coordinate) read_integer(&reader, 2);
+    Coordinate height = (Coordinate) read_integer(&reader, 2);
+    if (version != SAVE_VERSION || width < MAX_TETRIMINO_LENGTH || height < MAX_TETRIMINO_LENGTH ||
+        width > MAX_WELL_WIDTH || height > MAX_WELL_HEIGHT ||
+        size != SAVE_HEADER_SIZE + cells_size(width, height) + SAVE_CHECKSUM_SIZE) {
+        return NULL;
+    }
+    Reader checksum = {data + size - SAVE_CHECKSUM_SIZE};
+    if (crc32(data, size - SAVE_CHECKSUM_SIZE) != read_integer(&checksum, SAVE_CHECKSUM_SIZE)) {
+        return NULL;
+    }
+
+    GameInfo *game = create_empty_game(width, height);
+    if (!game) {
+        return NULL;
+    }
+    bool valid = true;
+    game->seed = read_integer(&reader, 8);
+    game->random.state = read_integer(&reader, 8);
+    game->random.increment = read_integer(&reader, 8);
+    game->randomizer = (uint8_t) read_integer(&reader, 1);
+    game->bag_count = (uint8_t) read_integer(&reader, 1);
+    valid = valid && game->randomizer <= RANDOMIZER_BAG && game->bag_count <= TETRIMINO_SHAPE_COUNT &&
+            (game->random.increment & 1);
+    for (int i = 0; i < TETRIMINO_SHAPE_COUNT; i++) {
+        game->bag[i] = (BlockType) read_integer(&reader, 1);
+        valid = valid && (i >= game->bag_count || valid_tetrimino_type(game->bag[i]));
+    }
+    game->scores = (uint32_t) read_integer(&reader, 4);
+    game->count = (uint32_t) read_integer(&reader, 4);
+    game->current.type = (BlockType) read_integer(&reader, 1);
+    game->current.rotation = (uint8_t) read_integer(&reader, 1);
+    game->current.x = (Coordinate) read_integer(&reader, 2);
+    game->current.y = (Coordinate) read_integer(&reader, 2);
+    valid = valid && valid_tetrimino_type(game->current.type) && game->current.rotation < 4;
+    for (int i = 0; i <= FORECAST_COUNT; i++) {
+        game->forecasts[i].type = (BlockType) read_integer(&reader, 1);
+        game->forecasts[i].rotation = (uint8_t) read_integer(&reader, 1);
+        valid = valid && valid_tetrimino_type(game->forecasts[i].type) && game->forecasts[i].rotation < 4;
+    }
+
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (Coordinate y = 0; y < height && valid; y++) {
+        for (Coordinate x = 0; x < width; x++) {
+            if (bit_count < CELL_BITS) {
+                bits |= (uint32_t) *reader.p++ << bit_count;
+                bit_count += 8;
+            }
+            uint32_t cell = bits & ((1 << CELL_BITS) - 1);
+            bits >>= CELL_BITS;
+            bit_count -= CELL_BITS;
+            if (cell) {
+                set_well_block(game, x, y, (BlockType) (BLOCK_TYPE_NORMAL_MIN + cell - 1));
+            }
+        }
+    }
+
+    update_column_heights(game);
+
+    // 有方块的行必须从底部开始连续，消行时依赖这一点
+    for (Coordinate y = 1; y < height && valid; y++) {
+        valid = row_is_empty(game, y) || !row_is_empty(game, y - 1);
+    }
+
+    // 当前骨板必须在游戏池中，并且不与已有的方块重叠
+    valid = valid && game->current.x >= 0 && game->current.x < width &&
+            game->current.y >= 0 && game->current.y < height + MAX_TETRIMINO_LENGTH &&
+            !tetrimino_collides(game, &game->current, game->current.x, game->current.y);
+    if (!valid) {
+        free(game);
+        return NULL;
+    }
+    game->previous = game->current;
+    return game;
+}
+
+
+bool save_game_file(const char *path, GameInfo *game) {
+    uint8_t *buffer = malloc(saved_game_size(game));
+    if (!buffer) {
+        return false;
+    }
+    size_t size = serialize_game(game, buffer);
+    bool successful = write_file_atomically(path, buffer, size);
+    free(buffer);
+    return successful;
+}
+
+
+GameInfo *load_game_file(const char *path) {
+    size_t size;
+    const uint8_t *data = map_file(path, &size);
+    if (!data) {
+        return NULL;
+    }
+    GameInfo *game = deserialize_game(data, size);
+    unmap_file(data, size);
+    return game;
+}
@@ -0,0 +1,36 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+// 游戏进度的存档格式，与内存布局、字节序和编译器无关
+//
+// 多字节整数均为小端序：
+//   4字节 "CTSV"，1字节 版本号
+//   2字节 宽度，2字节 高度
+//   8字节 种子，8字节 随机数发生器状态，8字节 随机数发生器增量
+//   1字节 randomizer，1字节 袋中剩余个数，7字节 袋中的骨板
+//   4字节 得分，4字节 数量
+//   当前骨板：1字节 种类，1字节 朝向，2字节 x，2字节 y
+//   每个预报骨板：1字节 种类，1字节 朝向
+//   游戏池中可见的各行，每格3位，0为空，1到7为骨板种类，从左下角开始逐行紧密排列，最后不足一字节补0
+//   4字节 以上全部内容的CRC-32
+// 墙壁和顶部预留的空行都是确定的，不用保存
+
+#include "tetris.h"
+
+
+// 游戏存档后的大小
+size_t saved_game_size(GameInfo *game);
+
+// 将游戏写入buffer，其大小至少为saved_game_size，返回写入的字节数
+size_t serialize_game(GameInfo *game, uint8_t *buffer);
+
+// 从存档恢复游戏，先检查版本、大小、校验和以及每一项内容是否合理，不合法返回NULL
+GameInfo *deserialize_game(const uint8_t *data, size_t size);
+
+// 保存到文件，先写临时文件再改名，不会损坏已有的存档
+bool save_game_file(const char *path, GameInfo *game);
+
+// 映射文件并从中恢复游戏，失败返回NULL
+GameInfo *load_game_file(const char *path);
+
+#endif
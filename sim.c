@@ -0,0 +1,364 @@
+#include "platform.h"
+#include "tetris.h"
+#include "rowscan.h"
+#include "board.h"
+#include "thread_pool.h"
+#include "autoplay.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// 批量模拟：不经过控制台，用随机或者脚本策略在多个线程上同时进行大量游戏，统计结果
+// 时间是模拟出来的，自动下落按照fall_interval，和真正游戏中start_game的计时规则一致
+
+
+// 默认参数
+#define DEFAULT_GAME_COUNT      1000
+#define DEFAULT_ACTION_TIME     100     // 两次动作之间的间隔，毫秒
+#define DEFAULT_MAX_PIECES      100000  // 每局最多的骨板数，避免永远不结束
+#define DEFAULT_LOOKAHEAD       1       // 自动游戏考虑的预报骨板个数
+
+
+typedef enum {
+    POLICY_RANDOM,      // 每次随机选择左移、右移、旋转、下落、快速下落之一
+    POLICY_SCRIPTED,    // 每个新骨板都从头执行一遍脚本，然后一直快速下落
+    POLICY_AUTOPLAY     // 与游戏中的--autoplay相同，搜索最好的落点然后移动过去
+} Policy;
+
+typedef struct {
+    uint64_t seed;
+    Randomizer randomizer;
+    Policy policy;
+    const char *script;
+    uint64_t action_time;
+    uint32_t max_pieces;
+    int lookahead;
+    Coordinate width;
+    Coordinate height;
+    // 执行动作的规则实现，默认按大小选用编译期特化的版本
+    StepFunction step;
+    // 同时用step_game在另一份游戏中执行同样的动作，每一步之后比较两者
+    bool verify;
+} SimulationOptions;
+
+typedef struct {
+    uint64_t seed;
+    uint32_t pieces;
+    uint32_t lines;
+    uint32_t scores;
+    // 模拟的游戏时长，纳秒
+    uint64_t duration;
+    // 校验时step与step_game的结果不一致，这一局在不一致处停止
+    bool mismatched;
+} GameResult;
+
+typedef struct {
+    const SimulationOptions *options;
+    GameResult *results;
+    // 每个工作线程一个，各自在本线程中搜索
+    Autoplayer **autoplayers;
+} Simulation;
+
+
+// 脚本中的字符与动作的对应，与游戏中的WSAD按键一致，空格为快速下降
+static Action script_action(char c) {
+    switch (c) {
+        case 'a':
+            return ACTION_LEFT;
+        case 'd':
+            return ACTION_RIGHT;
+        case 'w':
+            return ACTION_ROTATE;
+        case 's':
+            return ACTION_DOWN;
+        case ' ':
+            return ACTION_FAST_DOWN;
+        default:
+            return ACTION_EMPTY;
+    }
+}
+
+
+// 两个动作的结果是否相同，没有消行时其余字段没有意义
+static bool same_events(const StepEvents *a, const StepEvents *b) {
+    if (a->flags != b->flags || a->full_count != b->full_count) {
+        return false;
+    }
+    return !(a->flags & EVENT_LINES_CLEARED) ||
+           (memcmp(a->cleared_rows, b->cleared_rows, sizeof(Coordinate) * a->full_count) == 0 &&
+            a->dirty_bottom == b->dirty_bottom && a->dirty_top == b->dirty_top);
+}
+
+static bool same_tetrimino(const Tetrimino *a, const Tetrimino *b) {
+    return a->type == b->type && a->rotation == b->rotation && a->x == b->x && a->y == b->y;
+}
+
+// 两局游戏的状态是否相同，逐个比较字段，结构体中的填充字节不算；游戏池、位图和各列高度整块比较
+static bool same_game(const GameInfo *a, const GameInfo *b) {
+    if (a->random.state != b->random.state || a->random.increment != b->random.increment ||
+        a->bag_count != b->bag_count || memcmp(a->bag, b->bag, sizeof(a->bag)) != 0 ||
+        !same_tetrimino(&a->current, &b->current) || a->scores != b->scores || a->count != b->count) {
+        return false;
+    }
+    for (int i = 0; i <= FORECAST_COUNT; i++) {
+        if (!same_tetrimino(&a->forecasts[i], &b->forecasts[i])) {
+            return false;
+        }
+    }
+    return memcmp(a->well, b->well, game_info_size(a->width, a->height) - offsetof(GameInfo, well)) == 0;
+}
+
+
+// 用选定的规则执行一个动作，校验时shadow用step_game执行同样的动作，不一致就记入result
+static StepEvents step_checked(const SimulationOptions *options, GameInfo *game, GameInfo *shadow, Action action,
+                               GameResult *result) {
+    StepEvents events = options->step(game, action);
+    if (shadow) {
+        StepEvents expected = step_game(shadow, action);
+        if (!same_events(&events, &expected) || !same_game(game, shadow)) {
+            result->mismatched = true;
+        }
+    }
+    return events;
+}
+
+
+// 进行一局游戏，直到结束或者达到最多骨板数
+static void simulate_game(void *context, size_t index, int worker) {
+    Simulation *simulation = context;
+    const SimulationOptions *options = simulation->options;
+    GameResult *result = &simulation->results[index];
+    memset(result, 0, sizeof(GameResult));
+    result->seed = options->seed + index;
+
+    GameInfo *game = create_new_game(options->width, options->height, result->seed, options->randomizer);
+    GameInfo *shadow = options->verify ?
+                       create_new_game(options->width, options->height, result->seed, options->randomizer) : NULL;
+    if (!game || (options->verify && !shadow)) {
+        free(game);
+        free(shadow);
+        return;
+    }
+    // 策略使用的随机数与骨板序列的分开，这样改变策略不影响骨板序列
+    Random random;
+    random_seed(&random, ~result->seed);
+    static const Action random_actions[] = {
+            ACTION_LEFT, ACTION_RIGHT, ACTION_ROTATE, ACTION_DOWN, ACTION_FAST_DOWN
+    };
+
+    uint64_t now = 0;
+    uint64_t fall_time = fall_interval(game);
+    size_t script_position = 0;
+    bool planned = false;
+    while (!is_game_over(game) && game->count < options->max_pieces && !result->mismatched) {
+        // 先进行这段时间内到时的自动下落
+        uint64_t action_time = now + options->action_time;
+        StepEvents events = {0};
+        while (fall_time <= action_time && !(events.flags & EVENT_LOCKED)) {
+            now = fall_time;
+            events = step_checked(options, game, shadow, ACTION_DOWN, result);
+            fall_time += fall_interval(game);
+        }
+        if (!(events.flags & EVENT_LOCKED)) {
+            now = action_time;
+            Action action;
+            if (options->policy == POLICY_RANDOM) {
+                action = random_actions[random_below(&random, sizeof(random_actions) / sizeof(random_actions[0]))];
+            } else if (options->policy == POLICY_AUTOPLAY) {
+                if (!planned) {
+                    plan_placement(simulation->autoplayers[worker], game);
+                    planned = true;
+                }
+                action = next_autoplay_action(simulation->autoplayers[worker], game);
+            } else if (options->script[script_position]) {
+                action = script_action(options->script[script_position++]);
+            } else {
+                action = ACTION_FAST_DOWN;
+            }
+            events = step_checked(options, game, shadow, action, result);
+            if ((action == ACTION_DOWN && events.flags & EVENT_MOVED) || action == ACTION_FAST_DOWN) {
+                fall_time = now + fall_interval(game);
+            }
+        }
+        if (events.flags & EVENT_LOCKED) {
+            result->lines += events.full_count;
+            fall_time = now + fall_interval(game);
+            script_position = 0;
+            planned = false;
+        }
+    }
+
+    result->pieces = game->count;
+    result->scores = game->scores;
+    result->duration = now;
+    free(game);
+    free(shadow);
+}
+
+
+static int print_usage(const char *program) {
+    fprintf(stderr, "用法: %s [选项]\n"
+                    "  --games N        模拟的局数，默认%d\n"
+                    "  --threads N      线程数，默认为处理器个数\n"
+                    "  --seed N         第一局的种子，之后各局依次加1，默认为0\n"
+                    "  --bag            7种骨板一袋，袋中依次取出\n"
+                    "  --script S       每个新骨板执行的动作，a/d/w/s/空格分别为左右旋转下落快速下落\n"
+                    "                   执行完后一直快速下落，不指定则使用随机策略\n"
+                    "  --autoplay       使用自动游戏的策略\n"
+                    "  --lookahead N    自动游戏最多考虑的预报骨板个数，0到%d，默认%d，游戏池较大时自动减少\n"
+                    "  --action-ms N    两次动作之间的模拟间隔，默认%d毫秒\n"
+                    "  --max-pieces N   每局最多的骨板数，默认%d\n"
+                    "  --width N        游戏池的宽度，%d到%d，默认%d\n"
+                    "  --height N       游戏池的高度，%d到%d，默认%d\n"
+                    "  --generic        不使用编译期特化的规则，用于比较两者的速度\n"
+                    "  --verify         每一步都与通用的规则比较，有不一致的局时退出码为1\n"
+                    "  --quiet          不输出每一局的结果\n",
+            program, DEFAULT_GAME_COUNT, MAX_LOOKAHEAD, DEFAULT_LOOKAHEAD, DEFAULT_ACTION_TIME, DEFAULT_MAX_PIECES,
+            MAX_TETRIMINO_LENGTH, MAX_WELL_WIDTH, DEFAULT_WELL_WIDTH,
+            MAX_TETRIMINO_LENGTH, MAX_WELL_HEIGHT, DEFAULT_WELL_HEIGHT);
+    return 1;
+}
+
+
+// 解析非负整数参数
+static bool parse_number(const char *text, uint64_t *value) {
+    char *end;
+    *value = strtoull(text, &end, 0);
+    return *text && *text != '-' && !*end;
+}
+
+
+int main(int argc, char *argv[]) {
+    SimulationOptions options = {0, RANDOMIZER_UNIFORM, POLICY_RANDOM, NULL,
+                                 DEFAULT_ACTION_TIME * 1000000ull, DEFAULT_MAX_PIECES, DEFAULT_LOOKAHEAD,
+                                 DEFAULT_WELL_WIDTH, DEFAULT_WELL_HEIGHT, NULL, false};
+    uint64_t game_count = DEFAULT_GAME_COUNT;
+    uint64_t thread_count = 0;
+    bool quiet = false;
+    bool generic = false;
+    for (int i = 1; i < argc; i++) {
+        // 带参数的选项，参数必须是非负整数
+        const char *option = argv[i];
+        uint64_t value = 0;
+        if (strcmp(option, "--games") == 0 || strcmp(option, "--threads") == 0 ||
+            strcmp(option, "--seed") == 0 || strcmp(option, "--action-ms") == 0 ||
+            strcmp(option, "--max-pieces") == 0 || strcmp(option, "--lookahead") == 0 ||
+            strcmp(option, "--width") == 0 || strcmp(option, "--height") == 0) {
+            if (++i >= argc || !parse_number(argv[i], &value)) {
+                return print_usage(argv[0]);
+            }
+        }
+
+        if (strcmp(option, "--games") == 0) {
+            game_count = value;
+        } else if (strcmp(option, "--threads") == 0 && value <= 1024) {
+            thread_count = value;
+        } else if (strcmp(option, "--seed") == 0) {
+            options.seed = value;
+        } else if (strcmp(option, "--action-ms") == 0 && value > 0 && value <= 3600000) {
+            options.action_time = value * 1000000;
+        } else if (strcmp(option, "--max-pieces") == 0 && value <= UINT32_MAX) {
+            options.max_pieces = (uint32_t) value;
+        } else if (strcmp(option, "--lookahead") == 0 && value <= MAX_LOOKAHEAD) {
+            options.lookahead = (int) value;
+        } else if (strcmp(option, "--width") == 0 && value >= MAX_TETRIMINO_LENGTH && value <= MAX_WELL_WIDTH) {
+            options.width = (Coordinate) value;
+        } else if (strcmp(option, "--height") == 0 && value >= MAX_TETRIMINO_LENGTH && value <= MAX_WELL_HEIGHT) {
+            options.height = (Coordinate) value;
+        } else if (strcmp(option, "--autoplay") == 0) {
+            options.policy = POLICY_AUTOPLAY;
+        } else if (strcmp(option, "--bag") == 0) {
+            options.randomizer = RANDOMIZER_BAG;
+        } else if (strcmp(option, "--script") == 0 && i + 1 < argc) {
+            options.policy = POLICY_SCRIPTED;
+            options.script = argv[++i];
+        } else if (strcmp(option, "--generic") == 0) {
+            generic = true;
+        } else if (strcmp(option, "--verify") == 0) {
+            options.verify = true;
+        } else if (strcmp(option, "--quiet") == 0) {
+            quiet = true;
+        } else {
+            return print_usage(argv[0]);
+        }
+    }
+    if (options.policy == POLICY_AUTOPLAY && !autoplay_supported(options.width, options.height)) {
+        fprintf(stderr, "游戏池太大，无法自动游戏\n");
+        return 1;
+    }
+    options.step = generic ? step_game : select_step_function(options.width, options.height);
+    // 在启动线程之前选好消行扫描的内核
+    init_row_kernels();
+
+    Simulation simulation = {&options, calloc(game_count ? game_count : 1, sizeof(GameResult)), NULL};
+    ThreadPool *pool = create_thread_pool((int) thread_count);
+    bool successful = simulation.results && pool;
+    if (successful && options.policy == POLICY_AUTOPLAY) {
+        simulation.autoplayers = calloc(thread_pool_size(pool), sizeof(Autoplayer *));
+        successful = simulation.autoplayers != NULL;
+        for (int i = 0; successful && i < thread_pool_size(pool); i++) {
+            successful = (simulation.autoplayers[i] = create_autoplayer(options.lookahead, NULL)) != NULL;
+            if (successful) {
+                set_autoplay_step_function(simulation.autoplayers[i], options.step);
+            }
+        }
+    }
+    if (!successful) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+
+    uint64_t start_time = get_monotonic_time();
+    run_thread_pool(pool, game_count, simulate_game, &simulation);
+    double elapsed = (get_monotonic_time() - start_time) / 1e9;
+
+    // 逐局结果以及汇总
+    uint64_t total_pieces = 0, total_lines = 0, total_scores = 0, total_duration = 0;
+    uint32_t max_scores = 0;
+    uint64_t mismatches = 0;
+    if (!quiet) {
+        printf("%-20s %10s %10s %10s %12s\n", "seed", "pieces", "lines", "scores", "seconds");
+    }
+    for (uint64_t i = 0; i < game_count; i++) {
+        GameResult *result = &simulation.results[i];
+        if (!quiet) {
+            printf("%-20"PRIu64" %10"PRIu32" %10"PRIu32" %10"PRIu32" %12.1f\n", result->seed,
+                   result->pieces, result->lines, result->scores, result->duration / 1e9);
+        }
+        total_pieces += result->pieces;
+        total_lines += result->lines;
+        total_scores += result->scores;
+        total_duration += result->duration;
+        if (result->scores > max_scores) {
+            max_scores = result->scores;
+        }
+        if (result->mismatched) {
+            fprintf(stderr, "种子%"PRIu64"的一局与通用的规则不一致\n", result->seed);
+            mismatches++;
+        }
+    }
+    double games = game_count ? (double) game_count : 1;
+    printf("games: %"PRIu64", threads: %d, rules: %s, elapsed: %.3fs, %.1f games/s\n",
+           game_count, thread_pool_size(pool), options.step == step_game ? "generic" : "specialized",
+           elapsed, game_count / (elapsed > 0 ? elapsed : 1e-9));
+    printf("mean pieces: %.2f, mean lines: %.2f, mean scores: %.2f, max scores: %"PRIu32
+           ", mean seconds: %.1f\n",
+           total_pieces / games, total_lines / games, total_scores / games, max_scores,
+           total_duration / games / 1e9);
+    if (options.verify) {
+        printf("verified: %"PRIu64" games, mismatches: %"PRIu64"\n", game_count, mismatches);
+    }
+
+    if (simulation.autoplayers) {
+        for (int i = 0; i < thread_pool_size(pool); i++) {
+            destroy_autoplayer(simulation.autoplayers[i]);
+        }
+        free(simulation.autoplayers);
+    }
+    destroy_thread_pool(pool);
+    write_trace("tetris-sim.trace.json");
+    free(simulation.results);
+    return mismatches ? 1 : 0;
+}
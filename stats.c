@@ -0,0 +1,206 @@
+#include "stats.h"
+
+#include <string.h>
+
+
+// 直方图的桶：小于8的值各占一个桶，之后每个2的幂次区间再等分为8个桶，相对误差不超过1/8
+#define SUB_BUCKET_BITS         3
+#define SUB_BUCKET_COUNT        (1 << SUB_BUCKET_BITS)
+#define BUCKET_COUNT            ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT)
+
+// 延迟分布中每个桶的条形最长的字符数
+#define BAR_WIDTH               40
+
+typedef struct {
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+} Histogram;
+
+// 逐帧统计的各项，时间单位为纳秒
+typedef enum {
+    METRIC_LOGIC, METRIC_OUTPUT, METRIC_WAIT,
+    METRIC_BYTES, METRIC_CURSOR_MOVES, METRIC_COLOR_CHANGES,
+    METRIC_LATENCY,
+    METRIC_COUNT
+} Metric;
+
+static const struct {
+    const char *name;
+    // 输出时除以这个数，时间以毫秒输出
+    double scale;
+} metric_info[METRIC_COUNT] = {
+        {"logic (ms)", 1e6},
+        {"output (ms)", 1e6},
+        {"wait (ms)", 1e6},
+        {"bytes", 1},
+        {"cursor moves", 1},
+        {"color changes", 1},
+        {"latency (ms)", 1e6},
+};
+
+
+static bool enabled;
+static StatsPhase phase;
+static uint64_t phase_start;
+// 本帧各部分的耗时
+static uint64_t phase_times[STATS_PHASE_COUNT];
+// 本帧处理的输入的到达时间，0表示本帧没有处理输入
+static uint64_t input_arrival;
+// 上一帧结束时的输出统计
+static OutputStats last_output;
+static uint64_t frame_count;
+static Histogram histograms[METRIC_COUNT];
+
+
+static int bucket_of(uint64_t value) {
+    if (value < SUB_BUCKET_COUNT) {
+        return (int) value;
+    }
+    int exponent = 63;
+    while (!(value >> exponent)) {
+        exponent--;
+    }
+    int shift = exponent - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKET_COUNT + (int) ((value >> shift) & (SUB_BUCKET_COUNT - 1));
+}
+
+// 桶中的最大值
+static uint64_t bucket_limit(int bucket) {
+    if (bucket < SUB_BUCKET_COUNT) {
+        return (uint64_t) bucket;
+    }
+    int shift = bucket / SUB_BUCKET_COUNT - 1;
+    uint64_t lower = (uint64_t) (SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+    return lower + (((uint64_t) 1 << shift) - 1);
+}
+
+static void record(Histogram *histogram, uint64_t value) {
+    histogram->counts[bucket_of(value)]++;
+    histogram->count++;
+    histogram->total += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+// 不小于其中fraction比例的值的最小上界，按所在桶的最大值给出，但不超过实际的最大值
+static uint64_t percentile(const Histogram *histogram, double fraction) {
+    uint64_t rank = (uint64_t) (histogram->count * fraction + 0.5);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank && seen > 0) {
+            uint64_t limit = bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+
+void start_stats(void) {
+    enabled = true;
+    phase = STATS_PHASE_LOGIC;
+    phase_start = get_monotonic_time();
+    get_output_stats(&last_output);
+}
+
+
+void stats_phase(StatsPhase next) {
+    if (!enabled) {
+        return;
+    }
+    uint64_t now = get_monotonic_time();
+    phase_times[phase] += now - phase_start;
+    phase = next;
+    phase_start = now;
+}
+
+
+void stats_input(uint64_t arrival_time) {
+    if (enabled) {
+        input_arrival = arrival_time;
+    }
+}
+
+
+void stats_end_frame(void) {
+    if (!enabled) {
+        return;
+    }
+    stats_phase(STATS_PHASE_LOGIC);
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        record(&histograms[METRIC_LOGIC + i], phase_times[i]);
+        phase_times[i] = 0;
+    }
+
+    OutputStats output;
+    get_output_stats(&output);
+    record(&histograms[METRIC_BYTES], output.bytes - last_output.bytes);
+    record(&histograms[METRIC_CURSOR_MOVES], output.cursor_moves - last_output.cursor_moves);
+    record(&histograms[METRIC_COLOR_CHANGES], output.color_changes - last_output.color_changes);
+    last_output = output;
+
+    if (input_arrival) {
+        record(&histograms[METRIC_LATENCY], phase_start - input_arrival);
+        input_arrival = 0;
+    }
+    frame_count++;
+}
+
+
+void format_stats_summary(char *buffer, size_t size, int line) {
+    uint64_t total_time = 0;
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        total_time += histograms[METRIC_LOGIC + i].total;
+    }
+    const Histogram *latency = &histograms[METRIC_LATENCY];
+    if (line == 0) {
+        snprintf(buffer, size, "latency p50/p99/max %.2f/%.2f/%.2fms", percentile(latency, 0.5) / 1e6,
+                 percentile(latency, 0.99) / 1e6, latency->max / 1e6);
+    } else {
+        snprintf(buffer, size, "frame %.0fB, logic/out/wait %.1f/%.1f/%.1f%%",
+                 frame_count ? (double) histograms[METRIC_BYTES].total / frame_count : 0.0,
+                 total_time ? 100.0 * histograms[METRIC_LOGIC].total / total_time : 0.0,
+                 total_time ? 100.0 * histograms[METRIC_OUTPUT].total / total_time : 0.0,
+                 total_time ? 100.0 * histograms[METRIC_WAIT].total / total_time : 0.0);
+    }
+}
+
+
+void print_stats(FILE *file) {
+    fprintf(file, "frames: %"PRIu64", inputs: %"PRIu64"\n", frame_count, histograms[METRIC_LATENCY].count);
+    fprintf(file, "%-16s %10s %10s %10s %10s %14s\n", "per frame", "mean", "p50", "p99", "max", "total");
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        const Histogram *histogram = &histograms[i];
+        double scale = metric_info[i].scale;
+        fprintf(file, "%-16s %10.3f %10.3f %10.3f %10.3f %14.3f\n", metric_info[i].name,
+                histogram->count ? (double) histogram->total / histogram->count / scale : 0.0,
+                percentile(histogram, 0.5) / scale, percentile(histogram, 0.99) / scale,
+                histogram->max / scale, histogram->total / scale);
+    }
+
+    // 延迟的分布，只列出非空的桶
+    const Histogram *latency = &histograms[METRIC_LATENCY];
+    uint64_t peak = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        if (latency->counts[i] > peak) {
+            peak = latency->counts[i];
+        }
+    }
+    if (!peak) {
+        return;
+    }
+    fprintf(file, "latency distribution:\n");
+    char bar[BAR_WIDTH + 1];
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        if (latency->counts[i]) {
+            int length = (int) ((latency->counts[i] * BAR_WIDTH + peak - 1) / peak);
+            memset(bar, '#', length);
+            bar[length] = '\0';
+            fprintf(file, "  <= %10.3fms %10"PRIu64" %s\n", bucket_limit(i) / 1e6, latency->counts[i], bar);
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef STATS_H
+#define STATS_H
+
+// 性能统计：把游戏线程的时间分为逻辑、输出和等待输入三部分，逐帧记录各部分耗时、输出量，
+// 以及从输入到达到对应的绘制输出完毕的延迟，用于判断卡顿究竟来自控制台、输入等待还是绘制
+// 一帧是指两次end_frame之间的部分，每帧最多处理一个动作
+
+#include "platform.h"
+
+
+typedef enum {
+    // 处理动作以及在屏幕缓冲中绘制
+    STATS_PHASE_LOGIC,
+    // end_frame，真正输出到控制台
+    STATS_PHASE_OUTPUT,
+    // 在get_action中等待输入
+    STATS_PHASE_WAIT,
+    STATS_PHASE_COUNT
+} StatsPhase;
+
+
+// 开始统计，之前及未调用时下面的函数什么都不做
+void start_stats(void);
+
+// 切换到另一部分，之前的时间计入原来的部分
+void stats_phase(StatsPhase phase);
+
+// 本帧处理的动作来自在arrival_time到达的输入，延迟到本帧输出完毕为止
+void stats_input(uint64_t arrival_time);
+
+// 本帧输出完毕后调用，记录本帧各项数据，之后进入下一帧的逻辑部分
+void stats_end_frame(void);
+
+// 概要的行数
+#define STATS_SUMMARY_LINES     2
+
+// 到目前为止的概要中的第line行，不超过size个字节，供在信息面板上实时显示
+void format_stats_summary(char *buffer, size_t size, int line);
+
+// 输出全部统计结果，包括各项的p50/p99/最大值以及延迟的分布
+void print_stats(FILE *file);
+
+#endif
@@ -0,0 +1,341 @@
+#include "tetris.h"
+#include "rowscan.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// 以初始朝向的方块坐标，在编译期生成逆时针旋转rotation次之后的形状
+// 旋转以包围盒左下角为原点，宽w高h的包围盒旋转一次后变为宽h高w，方块(x, y)变为(h - 1 - y, x)
+#define MAX2(a, b)              ((a) > (b) ? (a) : (b))
+#define MAX4(a, b, c, d)        MAX2(MAX2(a, b), MAX2(c, d))
+#define ROTATED_X(r, w, h, x, y) ((r) == 0 ? (x) : (r) == 1 ? (h) - 1 - (y) : (r) == 2 ? (w) - 1 - (x) : (y))
+#define ROTATED_Y(r, w, h, x, y) ((r) == 0 ? (y) : (r) == 1 ? (x) : (r) == 2 ? (h) - 1 - (y) : (w) - 1 - (x))
+#define ROTATED_BLOCK_ROW(j, r, w, h, x, y) \
+    ((ROTATED_Y(r, w, h, x, y) == (j)) << ROTATED_X(r, w, h, x, y))
+#define ROTATED_ROW(j, r, w, h, x0, x1, x2, x3, y0, y1, y2, y3) \
+    (ROTATED_BLOCK_ROW(j, r, w, h, x0, y0) | ROTATED_BLOCK_ROW(j, r, w, h, x1, y1) | \
+     ROTATED_BLOCK_ROW(j, r, w, h, x2, y2) | ROTATED_BLOCK_ROW(j, r, w, h, x3, y3))
+#define ROTATED_SHAPE(r, w, h, x0, x1, x2, x3, y0, y1, y2, y3) { \
+    {ROTATED_X(r, w, h, x0, y0), ROTATED_X(r, w, h, x1, y1), \
+     ROTATED_X(r, w, h, x2, y2), ROTATED_X(r, w, h, x3, y3)}, \
+    {ROTATED_Y(r, w, h, x0, y0), ROTATED_Y(r, w, h, x1, y1), \
+     ROTATED_Y(r, w, h, x2, y2), ROTATED_Y(r, w, h, x3, y3)}, \
+    {ROTATED_ROW(0, r, w, h, x0, x1, x2, x3, y0, y1, y2, y3), \
+     ROTATED_ROW(1, r, w, h, x0, x1, x2, x3, y0, y1, y2, y3), \
+     ROTATED_ROW(2, r, w, h, x0, x1, x2, x3, y0, y1, y2, y3), \
+     ROTATED_ROW(3, r, w, h, x0, x1, x2, x3, y0, y1, y2, y3)}, \
+    (r) % 2 ? (h) : (w), (r) % 2 ? (w) : (h)}
+#define ALL_ROTATIONS(x0, x1, x2, x3, y0, y1, y2, y3) { \
+    ROTATED_SHAPE(0, MAX4(x0, x1, x2, x3) + 1, MAX4(y0, y1, y2, y3) + 1, x0, x1, x2, x3, y0, y1, y2, y3), \
+    ROTATED_SHAPE(1, MAX4(x0, x1, x2, x3) + 1, MAX4(y0, y1, y2, y3) + 1, x0, x1, x2, x3, y0, y1, y2, y3), \
+    ROTATED_SHAPE(2, MAX4(x0, x1, x2, x3) + 1, MAX4(y0, y1, y2, y3) + 1, x0, x1, x2, x3, y0, y1, y2, y3), \
+    ROTATED_SHAPE(3, MAX4(x0, x1, x2, x3) + 1, MAX4(y0, y1, y2, y3) + 1, x0, x1, x2, x3, y0, y1, y2, y3)}
+
+// 不同形状的骨板的全部4个朝向
+const TetriminoShape tetrimino_shapes[TETRIMINO_SHAPE_COUNT][4] = {
+        ALL_ROTATIONS(0, 0, 0, 0, 3, 2, 1, 0), // I
+        ALL_ROTATIONS(0, 1, 1, 0, 1, 1, 0, 0), // O
+        ALL_ROTATIONS(0, 1, 2, 1, 1, 1, 1, 0), // T
+        ALL_ROTATIONS(1, 1, 1, 0, 2, 1, 0, 0), // J
+        ALL_ROTATIONS(0, 0, 0, 1, 2, 1, 0, 0), // L
+        ALL_ROTATIONS(2, 1, 1, 0, 1, 1, 0, 0), // S
+        ALL_ROTATIONS(0, 1, 1, 2, 1, 1, 0, 0)  // Z
+};
+
+// 旋转后依次尝试的平移，往左或者往下平移可以避免碰壁也是允许的，通俗地说就是“顶过去”
+const Coordinate rotation_kicks[ROTATION_KICK_COUNT][2] = {
+        {0, 0}, {-1, 0}, {0, -1}, {-2, 0}, {0, -2}, {-3, 0}, {0, -3}
+};
+
+
+bool tetrimino_collides(GameInfo *game, Tetrimino *tetrimino, Coordinate x, Coordinate y) {
+    // 墙壁不在位图中，包围盒越出游戏池就是碰壁；形状的最左一列和最下一行总有方块，这与墙壁在位图中时是一样的
+    const TetriminoShape *shape = tetrimino_shape(tetrimino);
+    if (x < 0 || y < 0 || x + shape->width > game->width || y + shape->height > game->height + MAX_TETRIMINO_LENGTH) {
+        return true;
+    }
+    // 形状的一行可能跨过两个字
+    size_t stride = game->row_words;
+    const RowBits *row = well_row(game, y) + (size_t) x / ROW_BITS;
+    int shift = x % ROW_BITS;
+    for (int r = 0; r < shape->height; r++, row += stride) {
+        RowBits spill = shift > ROW_BITS - MAX_TETRIMINO_LENGTH ? (RowBits) shape->rows[r] >> (ROW_BITS - shift) : 0;
+        if ((row[0] & (RowBits) shape->rows[r] << shift) || (spill && (row[1] & spill))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool shift_tetrimino(GameInfo *game, Tetrimino *tetrimino, Coordinate offset_x, Coordinate offset_y) {
+    if (game && tetrimino_collides(game, tetrimino, tetrimino->x + offset_x, tetrimino->y + offset_y)) {
+        return false;
+    }
+    tetrimino->x += offset_x;
+    tetrimino->y += offset_y;
+    return true;
+}
+
+
+Coordinate drop_distance(GameInfo *game, Tetrimino *tetrimino) {
+    // 每个方块都不能低于所在列的高度，取其中最高的要求即为落点
+    const TetriminoShape *shape = tetrimino_shape(tetrimino);
+    Coordinate landing = 0;
+    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
+        Coordinate y = *column_height(game, tetrimino->x + shape->block_x[i]) - shape->block_y[i];
+        if (y > landing) {
+            landing = y;
+        }
+    }
+    if (landing <= tetrimino->y) {
+        return tetrimino->y - landing;
+    }
+    // 骨板已经在某一列的高度之下，例如塞到了悬空的方块下面，只能逐行检测
+    Coordinate y = tetrimino->y;
+    while (!tetrimino_collides(game, tetrimino, tetrimino->x, y - 1)) {
+        y--;
+    }
+    return tetrimino->y - y;
+}
+
+
+bool rotate_tetrimino(GameInfo *game, Tetrimino *tetrimino) {
+    // 旋转时包围盒左下角位置不变，然后依次尝试各个平移
+    Tetrimino tmp = *tetrimino;
+    tmp.rotation = (tmp.rotation + 1) % 4;
+    for (int i = 0; i < ROTATION_KICK_COUNT; i++) {
+        if (!game || shift_tetrimino(game, &tmp, rotation_kicks[i][0], rotation_kicks[i][1])) {
+            *tetrimino = tmp;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// 按照游戏的randomizer选出下一个骨板的种类
+static BlockType next_tetrimino_type(GameInfo *game) {
+    if (game->randomizer != RANDOMIZER_BAG) {
+        return BLOCK_TYPE_NORMAL_MIN + random_below(&game->random, TETRIMINO_SHAPE_COUNT);
+    }
+    if (game->bag_count == 0) {
+        // 重新装满一袋，Fisher-Yates洗牌
+        for (int i = 0; i < TETRIMINO_SHAPE_COUNT; i++) {
+            game->bag[i] = BLOCK_TYPE_NORMAL_MIN + i;
+        }
+        for (int i = TETRIMINO_SHAPE_COUNT - 1; i > 0; i--) {
+            int j = (int) random_below(&game->random, i + 1);
+            BlockType tmp = game->bag[i];
+            game->bag[i] = game->bag[j];
+            game->bag[j] = tmp;
+        }
+        game->bag_count = TETRIMINO_SHAPE_COUNT;
+    }
+    return game->bag[--game->bag_count];
+}
+
+
+// 注意forecasts[0]始终与游戏池当前骨板一致，已经不是“预”报了，所以这个它其实是不会显示的
+void generate_new_tetrimino(GameInfo *game) {
+    memmove(&game->forecasts[0], &game->forecasts[1], sizeof(game->forecasts[0]) * FORECAST_COUNT);
+    Tetrimino *forecast = &game->forecasts[FORECAST_COUNT];
+    forecast->type = next_tetrimino_type(game);
+    forecast->rotation = random_below(&game->random, 4);
+    forecast->x = forecast->y = 0;
+    spawn_tetrimino(game);
+}
+
+
+void spawn_tetrimino(GameInfo *game) {
+    game->current = game->forecasts[0];
+    shift_tetrimino(NULL, &game->current, (game->width - MAX_TETRIMINO_LENGTH) / 2, game->height);
+    game->previous = game->current;
+}
+
+
+GameInfo *create_empty_game(Coordinate width, Coordinate height) {
+    // 空的方块、位图和列高都是0，不用再逐行初始化，没有写入过的内存页也就不会真正分配
+    GameInfo *game = calloc(1, game_info_size(width, height));
+    if (!game) {
+        return NULL;
+    }
+    game->width = width;
+    game->height = height;
+    game->blocks_size = (uint32_t) well_blocks_size(width, height);
+    game->row_words = (uint32_t) row_word_count(width);
+    return game;
+}
+
+
+// 各列的高度只会变低，第x列从原来的高度height往下找到最高的方块，返回新的高度
+static Coordinate lower_column_height(GameInfo *game, Coordinate x, Coordinate height) {
+    size_t stride = game->row_words;
+    const RowBits *column = well_row(game, 0) + x / ROW_BITS;
+    RowBits bit = (RowBits) 1 << (x % ROW_BITS);
+    while (height > 0 && !(column[(size_t) (height - 1) * stride] & bit)) {
+        height--;
+    }
+    return height;
+}
+
+// 逐列往下找
+static void lower_column_heights(GameInfo *game) {
+    Coordinate *heights = column_height(game, 0);
+    for (Coordinate x = 0; x < game->width; x++) {
+        heights[x] = lower_column_height(game, x, heights[x]);
+    }
+}
+
+
+void update_column_heights(GameInfo *game) {
+    for (Coordinate x = 0; x < game->width; x++) {
+        *column_height(game, x) = game->height + MAX_TETRIMINO_LENGTH;
+    }
+    lower_column_heights(game);
+}
+
+
+GameInfo *create_new_game(Coordinate width, Coordinate height, uint64_t seed, Randomizer randomizer) {
+    GameInfo *game = create_empty_game(width, height);
+    if (!game) {
+        return NULL;
+    }
+    game->seed = seed;
+    random_seed(&game->random, seed);
+    game->randomizer = randomizer;
+
+    // 初始产生几个骨板，填满预报
+    for (int i = 0; i <= FORECAST_COUNT; i++) {
+        generate_new_tetrimino(game);
+    }
+    return game;
+}
+
+
+uint64_t fall_interval(GameInfo *game) {
+    uint64_t frame_time = 4000 / (100 + game->scores) + 30;
+    return FRAME_PER_ROW * frame_time * 1000000;
+}
+
+
+
+GameInfo *create_next_game(GameInfo *game) {
+    return create_new_game(game->width, game->height, random_next64(&game->random), game->randomizer);
+}
+
+bool is_game_over(GameInfo *game) {
+    return !row_is_empty(game, game->height);
+}
+
+
+// 移除全部满行，其上直到第一个空行的各行整段下移
+// 有方块的行总是从底部开始连续的（骨板总是落在已有的方块或者底部上），所以第一个空行以上不用再管了
+static void remove_full_rows(GameInfo *game, const StepEvents *events) {
+    compact_rows(game, events->cleared_rows, events->full_count, events->dirty_top);
+
+    // 满行包括了每一列，所以各列的最高方块都不低于最高的满行；高于它的列正好降低消除的行数，
+    // 只有最高方块就在最高的满行中的列要往下找新的最高方块，宽游戏池中消行时不必逐列查找
+    Coordinate lowered = events->cleared_rows[events->full_count - 1] + 1 - events->full_count;
+    Coordinate *heights = column_height(game, 0);
+    for (Coordinate x = 0; x < game->width; x++) {
+        heights[x] -= events->full_count;
+        if (heights[x] == lowered) {
+            heights[x] = lower_column_height(game, x, heights[x]);
+        }
+    }
+}
+
+
+// 骨板坠地，置入游戏池，然后消行
+static void lock_tetrimino(GameInfo *game, StepEvents *events) {
+    Tetrimino *current = &game->current;
+    const TetriminoShape *shape = tetrimino_shape(current);
+    for (int i = 0; i < BLOCKS_PER_TETRIMINO; i++) {
+        Coordinate x = current->x + shape->block_x[i];
+        Coordinate y = current->y + shape->block_y[i];
+        set_well_block(game, x, y, current->type);
+        if (*column_height(game, x) <= y) {
+            *column_height(game, x) = y + 1;
+        }
+    }
+    events->flags |= EVENT_LOCKED;
+
+    // 消行可得分，只有骨板所在的几行可能被填满；一趟扫描找出其中的满行，有满行时一直扫描到其上第一个空行
+    // 最低的满行与这个空行之间的各行都有变化
+    RowScan scan;
+    Coordinate full_top = current->y + shape->height < game->height ? current->y + shape->height : game->height;
+    scan_rows(game, current->y, full_top, false, &scan);
+    if (scan.full_count) {
+        events->full_count = scan.full_count;
+        memcpy(events->cleared_rows, scan.full_rows, sizeof(Coordinate) * scan.full_count);
+        events->dirty_bottom = scan.full_rows[0];
+        events->dirty_top = scan.top;
+        TRACE_SPAN("remove_full_rows") {
+            remove_full_rows(game, events);
+        }
+        events->flags |= EVENT_LINES_CLEARED;
+        game->scores += events->full_count * (events->full_count + 1) / 2;
+    }
+
+    // 产生新的骨板
+    game->count++;
+    generate_new_tetrimino(game);
+    if (is_game_over(game)) {
+        events->flags |= EVENT_GAME_OVER;
+    }
+}
+
+
+StepEvents step_game(GameInfo *game, Action action) {
+    StepEvents events = {0};
+    bool moved = false;
+    switch (action) {
+        case ACTION_LEFT:
+            TRACE_SPAN("shift_tetrimino") {
+                moved = shift_tetrimino(game, &game->current, -1, 0);
+            }
+            break;
+        case ACTION_RIGHT:
+            TRACE_SPAN("shift_tetrimino") {
+                moved = shift_tetrimino(game, &game->current, 1, 0);
+            }
+            break;
+        case ACTION_ROTATE:
+            TRACE_SPAN("rotate_tetrimino") {
+                moved = rotate_tetrimino(game, &game->current);
+            }
+            break;
+        case ACTION_DOWN:
+            TRACE_SPAN("shift_tetrimino") {
+                moved = shift_tetrimino(game, &game->current, 0, -1);
+            }
+            if (!moved) {
+                TRACE_SPAN("lock_tetrimino") {
+                    lock_tetrimino(game, &events);
+                }
+            }
+            break;
+        case ACTION_FAST_DOWN: {
+            // 一直下落到底，但是不立即坠地，到底之后再下落才会坠地
+            Coordinate distance = drop_distance(game, &game->current);
+            if (distance > 0) {
+                game->current.y -= distance;
+                moved = true;
+            } else {
+                TRACE_SPAN("lock_tetrimino") {
+                    lock_tetrimino(game, &events);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    if (moved) {
+        events.flags |= EVENT_MOVED;
+    }
+    return events;
+}
@@ -0,0 +1,237 @@
+#ifndef TETRIS_H
+#define TETRIS_H
+
+// 游戏规则，不包含任何输入输出，可以脱离控制台运行，例如用于批量模拟
+// 只使用了platform.h中的类型定义，并不调用其中的函数
+
+#include "platform.h"
+#include "random.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+// 每个骨板有4个方块，最长/宽也就是4
+#define BLOCKS_PER_TETRIMINO    4
+#define MAX_TETRIMINO_LENGTH    BLOCKS_PER_TETRIMINO
+// 骨板有7种形状
+#define TETRIMINO_SHAPE_COUNT   7
+
+// 每下降一行的时间相当于15帧
+#define FRAME_PER_ROW           15
+// 2个预报
+#define FORECAST_COUNT          2
+
+// 墙壁厚度，墙壁只用于显示，并不保存在游戏池中
+#define WALL_THICKNESS          1
+
+// 游戏池默认的大小以及允许的最大大小
+#define DEFAULT_WELL_WIDTH      10
+#define DEFAULT_WELL_HEIGHT     20
+#define MAX_WELL_WIDTH          8192
+#define MAX_WELL_HEIGHT         8192
+
+
+// 游戏池每一行的占用位图由若干个字组成，第x列是第x / ROW_BITS个字的第x % ROW_BITS位，不包括墙壁
+typedef uint64_t RowBits;
+#define ROW_BITS                64
+
+
+// 骨板某个朝向的形状，方块坐标以包围盒左下角为原点
+// rows是每一行的占用位图，以包围盒左侧为第0位，用于和游戏池位图做碰撞检测，width和height是包围盒的大小
+typedef struct {
+    Coordinate block_x[BLOCKS_PER_TETRIMINO];
+    Coordinate block_y[BLOCKS_PER_TETRIMINO];
+    uint8_t rows[MAX_TETRIMINO_LENGTH];
+    uint8_t width;
+    uint8_t height;
+} TetriminoShape;
+
+
+// 单个骨板的数据结构，包括其种类、朝向，以及包围盒左下角在游戏池中的位置
+typedef struct {
+    BlockType type;
+    uint8_t rotation;
+    Coordinate x;
+    Coordinate y;
+} Tetrimino;
+
+// 不同形状的骨板的全部4个朝向，见tetris.c
+extern const TetriminoShape tetrimino_shapes[TETRIMINO_SHAPE_COUNT][4];
+
+// 旋转后依次尝试的平移(x, y)，见tetris.c
+#define ROTATION_KICK_COUNT     7
+extern const Coordinate rotation_kicks[ROTATION_KICK_COUNT][2];
+
+
+// 获取骨板当前朝向的形状
+static inline const TetriminoShape *tetrimino_shape(const Tetrimino *tetrimino) {
+    return &tetrimino_shapes[tetrimino->type - BLOCK_TYPE_NORMAL_MIN][tetrimino->rotation];
+}
+
+
+// 产生新骨板种类的方式
+typedef enum {
+    RANDOMIZER_UNIFORM,     // 每次独立地均匀随机选取
+    RANDOMIZER_BAG          // 7种骨板装一袋，打乱后依次取出，取完再装一袋
+} Randomizer;
+
+
+// 保存游戏全部信息的结构体，可以用来保存恢复进度
+// well之后紧跟着与之对应的各行占用位图，见well_row，再之后是各列的高度，见column_height
+// 空的游戏池全部是0，所以用calloc分配，大游戏池中没有用到的上部在真正写入之前几乎不占内存
+typedef struct {
+    // 本局的种子，以及由其初始化的随机数发生器，保存进度后再载入，骨板序列可以接着原样产生
+    uint64_t seed;
+    Random random;
+    uint8_t randomizer;
+    // 袋中还剩的骨板，从后往前取
+    uint8_t bag_count;
+    BlockType bag[TETRIMINO_SHAPE_COUNT];
+    Tetrimino previous;
+    Tetrimino current;
+    Tetrimino forecasts[FORECAST_COUNT + 1];
+    uint32_t scores;
+    uint32_t count;
+    Coordinate width;
+    Coordinate height;
+    // 由宽高决定的well_blocks_size和row_word_count，创建时算好，访问位图时不用再重新计算
+    uint32_t blocks_size;
+    uint32_t row_words;
+    BlockType well[];
+} GameInfo;
+
+
+// 游戏池（包括顶部预留的空间）的总行数
+static inline Coordinate well_row_count(Coordinate height) {
+    return height + MAX_TETRIMINO_LENGTH;
+}
+
+// 每一行位图的字数
+static inline size_t row_word_count(Coordinate width) {
+    return ((size_t) width + ROW_BITS - 1) / ROW_BITS;
+}
+
+// 每一行位图的第word个字中属于游戏池的位，只有最后一个字可能不满
+static inline RowBits row_word_mask(Coordinate width, size_t word) {
+    size_t rest = (size_t) width - word * ROW_BITS;
+    return rest >= ROW_BITS ? ~(RowBits) 0 : ((RowBits) 1 << rest) - 1;
+}
+
+// 方块数组的大小，向上取整，使后面的位图相对于GameInfo的起始地址对齐
+static inline size_t well_blocks_size(Coordinate width, Coordinate height) {
+    size_t end = offsetof(GameInfo, well) + sizeof(BlockType) * width * well_row_count(height);
+    return (end + sizeof(RowBits) - 1) / sizeof(RowBits) * sizeof(RowBits) - offsetof(GameInfo, well);
+}
+
+// 包括方块、位图和列高在内的整个GameInfo的大小
+static inline size_t game_info_size(Coordinate width, Coordinate height) {
+    return offsetof(GameInfo, well) + well_blocks_size(width, height)
+           + sizeof(RowBits) * row_word_count(width) * well_row_count(height) + sizeof(Coordinate) * width;
+}
+
+
+// 利用坐标获取游戏池的方块了类型，以左下第一个方块为坐标原点，右上为正
+static inline BlockType *well_block(GameInfo *game, Coordinate x, Coordinate y) {
+    return &game->well[(size_t) y * game->width + x];
+}
+
+// 获取游戏池某一行的占用位图的第一个字，坐标同上
+static inline RowBits *well_row(GameInfo *game, Coordinate y) {
+    return (RowBits *) (game->well + game->blocks_size) + (size_t) y * game->row_words;
+}
+
+// 某一列的高度，即这一列最高的方块的纵坐标加1，空列为0，坐标同上
+// 这一高度以上都是空的，骨板在其上方时可以直接算出下落的距离
+static inline Coordinate *column_height(GameInfo *game, Coordinate x) {
+    return (Coordinate *) well_row(game, well_row_count(game->height)) + x;
+}
+
+// 游戏池(x, y)处是否有方块，只查位图
+static inline bool well_occupied(GameInfo *game, Coordinate x, Coordinate y) {
+    return well_row(game, y)[x / ROW_BITS] >> (x % ROW_BITS) & 1;
+}
+
+// 设置游戏池(x, y)处的方块，同时更新位图，但不更新列高
+static inline void set_well_block(GameInfo *game, Coordinate x, Coordinate y, BlockType type) {
+    *well_block(game, x, y) = type;
+    RowBits *word = well_row(game, y) + x / ROW_BITS;
+    RowBits bit = (RowBits) 1 << (x % ROW_BITS);
+    *word = type == BLOCK_TYPE_NULL ? *word & ~bit : *word | bit;
+}
+
+// 游戏池的第y行是否全空
+static inline bool row_is_empty(GameInfo *game, Coordinate y) {
+    const RowBits *row = well_row(game, y);
+    for (size_t i = 0; i < game->row_words; i++) {
+        if (row[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// step_game的结果中的事件
+#define EVENT_MOVED             1   // 当前骨板移动或者旋转了
+#define EVENT_LOCKED            2   // 当前骨板坠地置入游戏池，并产生了新的骨板
+#define EVENT_LINES_CLEARED     4   // 有行被消除
+#define EVENT_GAME_OVER         8   // 新的骨板已经没有位置，游戏结束
+
+// 执行一个动作的结果
+typedef struct {
+    uint32_t flags;
+    // 消除的行数，以及这些行在消除前的行号，从下往上
+    int full_count;
+    Coordinate cleared_rows[MAX_TETRIMINO_LENGTH];
+    // 消行后内容有变化的行的范围[dirty_bottom, dirty_top)，其余各行都没有变，不用重绘
+    Coordinate dirty_bottom;
+    Coordinate dirty_top;
+} StepEvents;
+
+
+// 判断骨板放在(x, y)处时是否“碰壁”，即与游戏池中已有的方块重叠或者越出了游戏池
+bool tetrimino_collides(GameInfo *game, Tetrimino *tetrimino, Coordinate x, Coordinate y);
+
+// 以指定偏移量平移一个骨板，如果没“碰壁”返回true，否则false，game为NULL时不检测碰壁
+bool shift_tetrimino(GameInfo *game, Tetrimino *tetrimino, Coordinate offset_x, Coordinate offset_y);
+
+// 骨板一直下落到底的距离
+Coordinate drop_distance(GameInfo *game, Tetrimino *tetrimino);
+
+// 逆时旋转骨板，同理返回布尔值表示是否可行
+bool rotate_tetrimino(GameInfo *game, Tetrimino *tetrimino);
+
+// 产生一个新的骨板，从预报依次递补
+void generate_new_tetrimino(GameInfo *game);
+
+// 把当前骨板放到forecasts[0]对应的初始位置，即游戏池顶部中间
+void spawn_tetrimino(GameInfo *game);
+
+// 创建空游戏池，骨板、得分和随机数发生器等都还是0，失败返回NULL
+GameInfo *create_empty_game(Coordinate width, Coordinate height);
+
+// 根据游戏池中的方块重新计算各列的高度，直接修改了方块之后需要调用
+void update_column_heights(GameInfo *game);
+
+// 初始化指定大小的新游戏，同一大小、种子和randomizer总是产生同样的骨板序列
+// 大小须在MAX_TETRIMINO_LENGTH到MAX_WELL_WIDTH/MAX_WELL_HEIGHT之间
+GameInfo *create_new_game(Coordinate width, Coordinate height, uint64_t seed, Randomizer randomizer);
+
+// 以本局的随机数发生器产生种子开始下一局，这样同一初始种子下的各局也都是可重现的
+GameInfo *create_next_game(GameInfo *game);
+
+// 判断游戏是否已经结束
+bool is_game_over(GameInfo *game);
+
+// 骨板自动下落一行的时间间隔，单位纳秒，分数越大，时间越短
+uint64_t fall_interval(GameInfo *game);
+
+// 对游戏执行一个动作，只处理骨板的移动、旋转和下落，返回所产生的事件
+// 下落不了时骨板坠地，随后消行计分并产生新的骨板
+StepEvents step_game(GameInfo *game, Action action);
+
+// 与step_game的参数和结果相同的规则实现，例如board.h中按游戏池大小特化的版本
+typedef StepEvents (*StepFunction)(GameInfo *game, Action action);
+
+#endif
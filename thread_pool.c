@@ -0,0 +1,256 @@
+#include "thread_pool.h"
+#include "threads.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <stdatomic.h>
+#include <unistd.h>
+#endif
+
+
+// 区间的原子操作
+#ifdef _WIN32
+
+typedef volatile LONG64 AtomicRange;
+
+static uint64_t load_range(AtomicRange *range) {
+    return (uint64_t) InterlockedCompareExchange64(range, 0, 0);
+}
+static void store_range(AtomicRange *range, uint64_t value) {
+    InterlockedExchange64(range, (LONG64) value);
+}
+static bool replace_range(AtomicRange *range, uint64_t expected, uint64_t desired) {
+    return InterlockedCompareExchange64(range, (LONG64) desired, (LONG64) expected) == (LONG64) expected;
+}
+
+#else
+
+typedef atomic_uint_fast64_t AtomicRange;
+
+static uint64_t load_range(AtomicRange *range) { return atomic_load(range); }
+static void store_range(AtomicRange *range, uint64_t value) { atomic_store(range, value); }
+static bool replace_range(AtomicRange *range, uint64_t expected, uint64_t desired) {
+    uint_fast64_t value = expected;
+    return atomic_compare_exchange_strong(range, &value, desired);
+}
+
+#endif
+
+
+// 一次最多分配的任务个数，区间的起点和终点各占32位
+#define MAX_BATCH_SIZE          UINT32_MAX
+
+// 区间打包成一个64位整数，以便整体原子地修改，高32位是起点，低32位是终点（不含）
+#define RANGE(begin, end)       ((uint64_t) (begin) << 32 | (end))
+#define RANGE_BEGIN(range)      ((uint32_t) ((range) >> 32))
+#define RANGE_END(range)        ((uint32_t) (range))
+
+// 每个工作线程的任务区间，单独占一个缓存行，避免伪共享
+typedef struct {
+    AtomicRange range;
+    char padding[64 - sizeof(AtomicRange)];
+} WorkerQueue;
+
+typedef struct {
+    ThreadPool *pool;
+    int index;
+} WorkerInfo;
+
+struct ThreadPool {
+    int thread_count;
+    Thread *threads;
+    WorkerInfo *workers;
+    WorkerQueue *queues;
+
+    // 以下由mutex保护，generation每次run_thread_pool加1，用来唤醒工作线程
+    Mutex mutex;
+    Condition start_condition;
+    Condition done_condition;
+    uint64_t generation;
+    int running;
+    bool stopping;
+
+    // 当前这一批的任务
+    TaskFunction task;
+    void *context;
+    size_t base;
+};
+
+
+// 从自己的区间头部取一个任务
+static bool take_task(WorkerQueue *queue, uint32_t *index) {
+    uint64_t range = load_range(&queue->range);
+    while (RANGE_BEGIN(range) < RANGE_END(range)) {
+        if (replace_range(&queue->range, range, RANGE(RANGE_BEGIN(range) + 1, RANGE_END(range)))) {
+            *index = RANGE_BEGIN(range);
+            return true;
+        }
+        range = load_range(&queue->range);
+    }
+    return false;
+}
+
+
+// 自己的区间空了，依次查看其他线程，从区间尾部窃取一半（至少一个）任务作为自己的新区间
+// 所有区间都空了返回false，此时可能还有任务正在执行或者刚被别的线程窃走，但都有人负责到底
+static bool steal_tasks(ThreadPool *pool, int thief) {
+    for (int i = 1; i < pool->thread_count; i++) {
+        WorkerQueue *victim = &pool->queues[(thief + i) % pool->thread_count];
+        uint64_t range = load_range(&victim->range);
+        while (RANGE_BEGIN(range) < RANGE_END(range)) {
+            uint32_t count = (RANGE_END(range) - RANGE_BEGIN(range) + 1) / 2;
+            uint32_t middle = RANGE_END(range) - count;
+            if (replace_range(&victim->range, range, RANGE(RANGE_BEGIN(range), middle))) {
+                store_range(&pool->queues[thief].range, RANGE(middle, RANGE_END(range)));
+                return true;
+            }
+            range = load_range(&victim->range);
+        }
+    }
+    return false;
+}
+
+
+// 工作线程执行当前这一批任务，直到再也取不到也偷不到
+static void work(ThreadPool *pool, int worker) {
+    WorkerQueue *queue = &pool->queues[worker];
+    while (true) {
+        uint32_t index;
+        if (take_task(queue, &index)) {
+            pool->task(pool->context, pool->base + index, worker);
+        } else if (!steal_tasks(pool, worker)) {
+            return;
+        }
+    }
+}
+
+
+static THREAD_FUNCTION(worker_main, argument) {
+    WorkerInfo *info = argument;
+    ThreadPool *pool = info->pool;
+    uint64_t generation = 0;
+    mutex_lock(&pool->mutex);
+    while (true) {
+        while (pool->generation == generation && !pool->stopping) {
+            condition_wait(&pool->start_condition, &pool->mutex);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        generation = pool->generation;
+        mutex_unlock(&pool->mutex);
+
+        work(pool, info->index);
+
+        mutex_lock(&pool->mutex);
+        if (--pool->running == 0) {
+            condition_broadcast(&pool->done_condition);
+        }
+    }
+    mutex_unlock(&pool->mutex);
+    THREAD_RETURN;
+}
+
+
+int processor_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int) count : 1;
+#endif
+}
+
+
+ThreadPool *create_thread_pool(int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = processor_count();
+    }
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->threads = calloc(thread_count, sizeof(Thread));
+    pool->workers = calloc(thread_count, sizeof(WorkerInfo));
+    pool->queues = calloc(thread_count, sizeof(WorkerQueue));
+    if (!pool->threads || !pool->workers || !pool->queues) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+    mutex_init(&pool->mutex);
+    condition_init(&pool->start_condition);
+    condition_init(&pool->done_condition);
+
+    // 0号工作线程就是调用者，不用创建；创建失败时就用已经创建的这些
+    pool->thread_count = 1;
+    for (int i = 1; i < thread_count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (!thread_create(&pool->threads[i], worker_main, &pool->workers[i])) {
+            break;
+        }
+        pool->thread_count++;
+    }
+    return pool;
+}
+
+
+int thread_pool_size(ThreadPool *pool) {
+    return pool->thread_count;
+}
+
+
+void run_thread_pool(ThreadPool *pool, size_t task_count, TaskFunction task, void *context) {
+    for (size_t base = 0; base < task_count; base += MAX_BATCH_SIZE) {
+        size_t batch = task_count - base < MAX_BATCH_SIZE ? task_count - base : MAX_BATCH_SIZE;
+        // 初始时平均分配给各个工作线程
+        for (int i = 0; i < pool->thread_count; i++) {
+            store_range(&pool->queues[i].range,
+                        RANGE(batch * i / pool->thread_count, batch * (i + 1) / pool->thread_count));
+        }
+
+        mutex_lock(&pool->mutex);
+        pool->task = task;
+        pool->context = context;
+        pool->base = base;
+        pool->generation++;
+        pool->running = pool->thread_count - 1;
+        condition_broadcast(&pool->start_condition);
+        mutex_unlock(&pool->mutex);
+
+        work(pool, 0);
+
+        // 其他线程可能还在执行最后的任务
+        mutex_lock(&pool->mutex);
+        while (pool->running > 0) {
+            condition_wait(&pool->done_condition, &pool->mutex);
+        }
+        mutex_unlock(&pool->mutex);
+    }
+}
+
+
+void destroy_thread_pool(ThreadPool *pool) {
+    mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    condition_broadcast(&pool->start_condition);
+    mutex_unlock(&pool->mutex);
+    for (int i = 1; i < pool->thread_count; i++) {
+        thread_join(pool->threads[i]);
+    }
+    condition_destroy(&pool->start_condition);
+    condition_destroy(&pool->done_condition);
+    mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->queues);
+    free(pool);
+}
@@ -0,0 +1,33 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// 工作窃取线程池，用于批量模拟等可以拆成大量独立任务的计算
+// 每个工作线程从自己的任务区间头部依次取任务，做完了就从别的线程的区间尾部窃取一半过来
+
+#include <stddef.h>
+
+
+typedef struct ThreadPool ThreadPool;
+
+// 任务函数，index是任务序号，worker是执行它的工作线程序号，从0开始，可以用来索引各线程自己的数据
+typedef void (*TaskFunction)(void *context, size_t index, int worker);
+
+
+// 当前机器的逻辑处理器个数
+int processor_count(void);
+
+// 创建线程池，共thread_count个工作线程，其中0号就是调用run_thread_pool的线程本身
+// thread_count不大于0时使用processor_count，失败返回NULL
+ThreadPool *create_thread_pool(int thread_count);
+
+// 线程池中工作线程的个数
+int thread_pool_size(ThreadPool *pool);
+
+// 并行执行序号为0到task_count - 1的全部任务，全部完成后才返回
+// 同一时刻只能有一个线程调用
+void run_thread_pool(ThreadPool *pool, size_t task_count, TaskFunction task, void *context);
+
+// 结束并回收全部工作线程
+void destroy_thread_pool(ThreadPool *pool);
+
+#endif
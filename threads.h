@@ -0,0 +1,85 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+// 线程、互斥量和条件变量的平台封装，POSIX下使用pthread，Windows下使用Win32 API
+// 线程函数用THREAD_FUNCTION定义，以THREAD_RETURN返回
+// 静态的互斥量可以用MUTEX_INITIALIZER初始化，不需要mutex_init和mutex_destroy，线程局部变量用THREAD_LOCAL声明
+
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+
+#ifdef _WIN32
+
+typedef HANDLE Thread;
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Condition;
+
+#define THREAD_FUNCTION(name, argument) DWORD WINAPI name(void *argument)
+#define THREAD_RETURN                   return 0
+#define MUTEX_INITIALIZER               SRWLOCK_INIT
+#define THREAD_LOCAL                    __declspec(thread)
+
+static inline bool thread_create(Thread *thread, DWORD (WINAPI *function)(void *), void *argument) {
+    return (*thread = CreateThread(NULL, 0, function, argument, 0, NULL)) != NULL;
+}
+
+static inline void thread_join(Thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static inline void mutex_init(Mutex *mutex) { InitializeSRWLock(mutex); }
+static inline void mutex_destroy(Mutex *mutex) { (void) mutex; }
+static inline void mutex_lock(Mutex *mutex) { AcquireSRWLockExclusive(mutex); }
+static inline void mutex_unlock(Mutex *mutex) { ReleaseSRWLockExclusive(mutex); }
+static inline void condition_init(Condition *condition) { InitializeConditionVariable(condition); }
+static inline void condition_destroy(Condition *condition) { (void) condition; }
+static inline void condition_wait(Condition *condition, Mutex *mutex) {
+    SleepConditionVariableSRW(condition, mutex, INFINITE, 0);
+}
+static inline void condition_broadcast(Condition *condition) { WakeAllConditionVariable(condition); }
+
+#else
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+
+#define THREAD_FUNCTION(name, argument) void *name(void *argument)
+#define THREAD_RETURN                   return NULL
+#define MUTEX_INITIALIZER               PTHREAD_MUTEX_INITIALIZER
+#define THREAD_LOCAL                    _Thread_local
+
+// 新线程继承创建者的信号掩码，创建期间屏蔽SIGINT和SIGTERM，这两个信号就只会交给主线程，打断其中的等待
+static inline bool thread_create(Thread *thread, void *(*function)(void *), void *argument) {
+    sigset_t signals, old_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    bool created = pthread_create(thread, NULL, function, argument) == 0;
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    return created;
+}
+
+static inline void thread_join(Thread thread) { pthread_join(thread, NULL); }
+
+static inline void mutex_init(Mutex *mutex) { pthread_mutex_init(mutex, NULL); }
+static inline void mutex_destroy(Mutex *mutex) { pthread_mutex_destroy(mutex); }
+static inline void mutex_lock(Mutex *mutex) { pthread_mutex_lock(mutex); }
+static inline void mutex_unlock(Mutex *mutex) { pthread_mutex_unlock(mutex); }
+static inline void condition_init(Condition *condition) { pthread_cond_init(condition, NULL); }
+static inline void condition_destroy(Condition *condition) { pthread_cond_destroy(condition); }
+static inline void condition_wait(Condition *condition, Mutex *mutex) { pthread_cond_wait(condition, mutex); }
+static inline void condition_broadcast(Condition *condition) { pthread_cond_broadcast(condition); }
+
+#endif
+
+#endif
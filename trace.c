@@ -0,0 +1,113 @@
+#include "trace.h"
+#include "platform.h"
+#include "threads.h"
+
+#include <stdlib.h>
+
+
+// 每个线程最多保留的记录数，必须是2的幂
+#define TRACE_CAPACITY          65536
+
+typedef struct {
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;
+    int thread_id;
+    const char *thread_name;
+    // 记录过的总数，超过容量后只有最后TRACE_CAPACITY个还在
+    uint64_t count;
+    TraceEvent events[TRACE_CAPACITY];
+} TraceBuffer;
+
+
+// 全部线程的缓冲，由mutex保护，只在线程第一次记录时加入
+static Mutex mutex = MUTEX_INITIALIZER;
+static TraceBuffer *buffers;
+static int thread_count;
+// 第一个记录的时间，作为输出的时间零点
+static uint64_t origin;
+
+static THREAD_LOCAL TraceBuffer *thread_buffer;
+
+
+// 当前线程的缓冲，内存不足时返回NULL，此后这个线程的记录都被丢弃
+static TraceBuffer *current_buffer(void) {
+    if (!thread_buffer) {
+        TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+        if (!buffer) {
+            return NULL;
+        }
+        mutex_lock(&mutex);
+        if (!buffers) {
+            origin = get_monotonic_time();
+        }
+        buffer->thread_id = ++thread_count;
+        buffer->next = buffers;
+        buffers = buffer;
+        mutex_unlock(&mutex);
+        thread_buffer = buffer;
+    }
+    return thread_buffer;
+}
+
+
+TraceSpan begin_trace_span(const char *name) {
+    TraceSpan span = {name, get_monotonic_time(), true};
+    return span;
+}
+
+
+void end_trace_span(TraceSpan *span) {
+    uint64_t end = get_monotonic_time();
+    span->active = false;
+    TraceBuffer *buffer = current_buffer();
+    if (buffer) {
+        TraceEvent *event = &buffer->events[buffer->count++ & (TRACE_CAPACITY - 1)];
+        event->name = span->name;
+        event->start = span->start;
+        event->duration = end - span->start;
+    }
+}
+
+
+void name_trace_thread(const char *name) {
+    TraceBuffer *buffer = current_buffer();
+    if (buffer) {
+        buffer->thread_name = name;
+    }
+}
+
+
+void write_trace(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return;
+    }
+    // 时间单位为微秒，"X"是有开始时间和持续时间的完整事件，"M"是线程名之类的元数据
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    mutex_lock(&mutex);
+    for (TraceBuffer *buffer = buffers; buffer; buffer = buffer->next) {
+        if (buffer->thread_name) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                          "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", buffer->thread_id, buffer->thread_name);
+            first = false;
+        }
+        uint64_t begin = buffer->count > TRACE_CAPACITY ? buffer->count - TRACE_CAPACITY : 0;
+        for (uint64_t i = begin; i < buffer->count; i++) {
+            const TraceEvent *event = &buffer->events[i & (TRACE_CAPACITY - 1)];
+            // 缓冲加入之前开始的代码段，开始时间可能早于时间零点
+            double start = ((double) event->start - (double) origin) / 1e3;
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n", event->name, buffer->thread_id, start, event->duration / 1e3);
+            first = false;
+        }
+    }
+    mutex_unlock(&mutex);
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
@@ -0,0 +1,46 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// 性能追踪：用TRACE_SPAN标出一段代码，记录其开始时间和耗时，退出时输出为Chrome trace格式的JSON，
+// 可以用chrome://tracing或者Perfetto打开查看
+//
+//   TRACE_SPAN("redraw_well") {
+//       redraw_well(game);
+//   }
+//
+// 每个线程记录在自己的环形缓冲中，写满后覆盖最早的记录，记录时不加锁
+// 代码块中不能用break、continue或return跳出，否则这一段不会被记录，continue还会只跳出代码块本身
+// 只有定义了ENABLE_TRACE（CMake选项ENABLE_TRACE）时才记录，否则下面的宏都展开为空，没有任何开销
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef ENABLE_TRACE
+
+typedef struct {
+    const char *name;
+    uint64_t start;
+    bool active;
+} TraceSpan;
+
+#define TRACE_SPAN(name) \
+    for (TraceSpan trace_span_ = begin_trace_span(name); trace_span_.active; end_trace_span(&trace_span_))
+
+TraceSpan begin_trace_span(const char *name);
+void end_trace_span(TraceSpan *span);
+
+// 给当前线程起个名字，显示在追踪结果中
+void name_trace_thread(const char *name);
+
+// 将全部线程的记录写入文件，调用时其他线程不能再记录
+void write_trace(const char *path);
+
+#else
+
+#define TRACE_SPAN(name)
+#define name_trace_thread(name)     ((void) 0)
+#define write_trace(path)           ((void) 0)
+
+#endif
+
+#endif